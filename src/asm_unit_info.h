@@ -3,13 +3,22 @@
 
 #include "hash_table.h"
 #include "dynarray.h"
+#include "string_pool.h"
 
 typedef struct reloc_pair_t
 {
     size_t reloc_index;
     const char* target_label;
+    uint64_t target_hash;
+    int target_handle; // builder label, only used when target_label is NULL
 } reloc_pair_t;
 
+typedef struct label_handle_t
+{
+    const char* name; // can be NULL
+    int addr;         // -1 until bound
+} label_handle_t;
+
 typedef struct string_constant_t
 {
     unsigned int id;
@@ -17,6 +26,22 @@ typedef struct string_constant_t
     uint16_t len;
 } string_constant_t;
 
+// optional image section, see image.h
+typedef struct image_section_t
+{
+    char tag[4];
+    DYNARRAY(uint8_t) data;
+} image_section_t;
+
+// see jump_table.h
+typedef struct jump_table_t
+{
+    const char* name; // NULL for tables created by the builder
+    uint64_t hash;
+    int defined;
+    DYNARRAY(reloc_pair_t) entries; // reloc_index is unused
+} jump_table_t;
+
 typedef struct asm_unit_t
 {
     const char* source;
@@ -24,6 +49,15 @@ typedef struct asm_unit_t
     DYNARRAY(reloc_pair_t) relocs;
     DYNARRAY(uint8_t) object_buffer;
     DYNARRAY(string_constant_t) strings;
+    string_pool_t string_pool; // owns the bytes of 'strings'
+    DYNARRAY(label_handle_t) label_handles;
+    DYNARRAY(image_section_t) sections;
+    DYNARRAY(jump_table_t) tables;
+
+    int code_base; // address of object_buffer.ptr[0], only non-zero when streaming
+    int pic;       // resolve relocations as position-independent code, see pic.h
+    void (*label_defined)(struct asm_unit_t* unit, const char* label, uint64_t hash, int addr);
+    void* user_data;
 } asm_unit_t;
 
 #endif // ASM_UNIT_INFO_H_INCLUDED
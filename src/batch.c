@@ -0,0 +1,507 @@
+#define _GNU_SOURCE
+
+#include "batch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "builder.h"
+#include "cache.h"
+#include "dynarray.h"
+#include "embed.h"
+#include "fatal.h"
+#include "image.h"
+#include "parser.h"
+#include "passes.h"
+#include "uring.h"
+
+#define BATCH_WINDOW     16    // files being read ahead, and files being written
+#define BATCH_READ_CHUNK 65536
+
+typedef enum job_stage_t
+{
+    STAGE_PENDING,
+    STAGE_OPENING,
+    STAGE_READING,
+    STAGE_READ,     // source in memory, waiting to be assembled
+    STAGE_CREATING,
+    STAGE_WRITING,
+    STAGE_CLOSING,
+    STAGE_DONE,
+    STAGE_FAILED
+} job_stage_t;
+
+typedef struct batch_job_t
+{
+    char* input;
+    char* output;
+    job_stage_t stage;
+    int fd;
+    char* source;
+    size_t size, capacity;
+    char* image;
+    size_t image_size, written;
+} batch_job_t;
+
+typedef struct batch_t
+{
+    DYNARRAY(batch_job_t) jobs;
+    const asm_options_t* options;
+    int failures;
+} batch_t;
+
+static int read_list(const char* path, batch_t* batch)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "could not open batch list '%s'\n", path);
+        return -1;
+    }
+
+    DYNARRAY_INIT(batch->jobs, 256);
+    char line[2 * 4096];
+    char input[4096], output[4096];
+    while (fgets(line, sizeof(line), file))
+    {
+        int fields = sscanf(line, "%4095s %4095s", input, output);
+        if (fields < 1)
+            continue;
+
+        batch_job_t job;
+        memset(&job, 0, sizeof(job));
+        job.input = strdup(input);
+        if (fields == 2)
+            job.output = strdup(output);
+        else
+        {
+            const char* dot = strrchr(input, '.');
+            const char* slash = strrchr(input, '/');
+            size_t stem = (dot && (!slash || dot > slash)) ? (size_t)(dot - input) : strlen(input);
+            job.output = malloc(stem + 5);
+            memcpy(job.output, input, stem);
+            strcpy(job.output + stem, ".bin");
+        }
+        job.fd = -1;
+        DYNARRAY_ADD(batch->jobs, job);
+    }
+    fclose(file);
+
+    return 0;
+}
+
+// 'error' is an errno value, 0 when the cause has already been reported
+static void fail_job(batch_t* batch, batch_job_t* job, const char* what, const char* path, int error)
+{
+    if (error)
+        fprintf(stderr, "%s '%s' : %s\n", what, path, strerror(error));
+    else
+        fprintf(stderr, "%s '%s'\n", what, path);
+    free(job->source);
+    free(job->image);
+    job->source = job->image = NULL;
+    job->stage = STAGE_FAILED;
+    ++batch->failures;
+}
+
+static void grow_source(batch_job_t* job)
+{
+    job->capacity = job->capacity ? job->capacity * 2 : BATCH_READ_CHUNK;
+    // one more byte for the terminator
+    job->source = realloc(job->source, job->capacity + 1);
+}
+
+// assembles the source in memory into an image in memory, returns -1 and fails the job on errors
+static int assemble_job(batch_t* batch, batch_job_t* job)
+{
+    job->source[job->size] = '\0';
+
+    asm_unit_t unit;
+    parse_init(&unit);
+    unit.source = job->source;
+    unit.pic = batch->options->pic;
+
+    // errors in the source only end this job
+    jmp_buf recovery;
+    if (setjmp(recovery))
+    {
+        asm_recovery_point = NULL;
+        free_asm_unit(&unit);
+        fail_job(batch, job, "could not assemble", job->input, 0);
+        return -1;
+    }
+    asm_recovery_point = &recovery;
+    parse_source(&unit, unit.source);
+    run_passes(&unit, batch->options);
+    asm_finish(&unit);
+    asm_recovery_point = NULL;
+
+    FILE* image = open_memstream(&job->image, &job->image_size);
+    int result = write_output(image, &unit, batch->options, job->output);
+    fclose(image);
+
+    free_asm_unit(&unit);
+    if (result != 0)
+    {
+        fail_job(batch, job, "could not write output file", job->output, 0);
+        return -1;
+    }
+    free(job->source);
+    job->source = NULL;
+    job->written = 0;
+
+    // the output may be a hardlink into the output cache
+    detach_output(job->output);
+
+    return 0;
+}
+
+static void run_pread(batch_t* batch)
+{
+    for (int i = 0; i < batch->jobs.size; ++i)
+    {
+        batch_job_t* job = &batch->jobs.ptr[i];
+
+        int fd = open(job->input, O_RDONLY);
+        if (fd < 0)
+        {
+            fail_job(batch, job, "could not open input file", job->input, errno);
+            continue;
+        }
+        for (;;)
+        {
+            if (job->size == job->capacity)
+                grow_source(job);
+            ssize_t rd = pread(fd, job->source + job->size, job->capacity - job->size, job->size);
+            if (rd <= 0)
+            {
+                if (rd < 0)
+                    fail_job(batch, job, "could not read input file", job->input, errno);
+                break;
+            }
+            job->size += rd;
+        }
+        close(fd);
+        if (job->stage == STAGE_FAILED)
+            continue;
+
+        if (assemble_job(batch, job) != 0)
+            continue;
+
+        fd = open(job->output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0)
+        {
+            fail_job(batch, job, "could not open output file", job->output, errno);
+            continue;
+        }
+        while (job->written < job->image_size)
+        {
+            ssize_t wr = write(fd, job->image + job->written, job->image_size - job->written);
+            if (wr < 0)
+            {
+                fail_job(batch, job, "could not write output file", job->output, errno);
+                break;
+            }
+            job->written += wr;
+        }
+        close(fd);
+
+        free(job->image);
+        job->image = NULL;
+        if (job->stage != STAGE_FAILED)
+            job->stage = STAGE_DONE;
+    }
+}
+
+#ifdef HAVE_URING
+
+// user_data is the job index times two, plus one for the input closes nobody waits for
+#define DETACHED_CLOSE 1
+
+typedef struct uring_batch_t
+{
+    uring_t ring;
+    batch_t* batch;
+    unsigned inflight;
+    int reading, writing; // jobs in the read and write stages
+} uring_batch_t;
+
+// returns NULL with errno set when the submission queue stays full
+static struct io_uring_sqe* next_sqe(uring_batch_t* ub, int index, int detached)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(&ub->ring);
+    if (!sqe)
+    {
+        // the kernel consumes the submitted entries right away, which frees their slots
+        int submitted;
+        while ((submitted = uring_submit(&ub->ring, 0)) < 0 && errno == EINTR)
+            ;
+        if (submitted < 0)
+            return NULL;
+        sqe = uring_get_sqe(&ub->ring);
+        if (!sqe)
+        {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+    sqe->user_data = (uint64_t)index * 2 + detached;
+    ++ub->inflight;
+
+    return sqe;
+}
+
+// queues the operation of the job's current stage, fails the job when it can't be queued
+static void queue_stage(uring_batch_t* ub, int index)
+{
+    batch_job_t* job = &ub->batch->jobs.ptr[index];
+    struct io_uring_sqe* sqe = next_sqe(ub, index, 0);
+    if (!sqe)
+    {
+        int error = errno;
+        int reading = job->stage == STAGE_OPENING || job->stage == STAGE_READING;
+        if (job->stage != STAGE_OPENING && job->stage != STAGE_CREATING)
+            close(job->fd);
+        fail_job(ub->batch, job, "could not queue operation on", reading ? job->input : job->output, error);
+        if (reading)
+            --ub->reading;
+        else
+            --ub->writing;
+        return;
+    }
+
+    switch (job->stage)
+    {
+        case STAGE_OPENING:
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)job->input;
+            sqe->open_flags = O_RDONLY;
+            break;
+        case STAGE_READING:
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = job->fd;
+            sqe->addr = (uintptr_t)(job->source + job->size);
+            sqe->len = job->capacity - job->size;
+            sqe->off = job->size;
+            break;
+        case STAGE_CREATING:
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)job->output;
+            sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+            sqe->len = 0666;
+            break;
+        case STAGE_WRITING:
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = job->fd;
+            sqe->addr = (uintptr_t)(job->image + job->written);
+            sqe->len = job->image_size - job->written;
+            sqe->off = job->written;
+            break;
+        case STAGE_CLOSING:
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = job->fd;
+            break;
+        default:
+            sqe->opcode = IORING_OP_NOP;
+            break;
+    }
+}
+
+static void complete(uring_batch_t* ub, const struct io_uring_cqe* cqe)
+{
+    --ub->inflight;
+    if (cqe->user_data & DETACHED_CLOSE)
+        return;
+
+    int index = cqe->user_data / 2;
+    batch_t* batch = ub->batch;
+    batch_job_t* job = &batch->jobs.ptr[index];
+    int res = cqe->res;
+
+    switch (job->stage)
+    {
+        case STAGE_OPENING:
+            if (res < 0)
+            {
+                fail_job(batch, job, "could not open input file", job->input, -res);
+                --ub->reading;
+                return;
+            }
+            job->fd = res;
+            job->stage = STAGE_READING;
+            grow_source(job);
+            queue_stage(ub, index);
+            break;
+
+        case STAGE_READING:
+            if (res < 0)
+            {
+                fail_job(batch, job, "could not read input file", job->input, -res);
+                close(job->fd);
+                --ub->reading;
+                return;
+            }
+            job->size += res;
+            if (res > 0 && job->size == job->capacity)
+            {
+                grow_source(job);
+                queue_stage(ub, index);
+                return;
+            }
+
+            // a short read of a regular file is the end of it
+            struct io_uring_sqe* sqe = next_sqe(ub, index, DETACHED_CLOSE);
+            if (sqe)
+            {
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = job->fd;
+            }
+            else
+                close(job->fd);
+            job->fd = -1;
+            job->stage = STAGE_READ;
+            --ub->reading;
+            break;
+
+        case STAGE_CREATING:
+            if (res < 0)
+            {
+                fail_job(batch, job, "could not open output file", job->output, -res);
+                --ub->writing;
+                return;
+            }
+            job->fd = res;
+            job->stage = job->image_size ? STAGE_WRITING : STAGE_CLOSING;
+            queue_stage(ub, index);
+            break;
+
+        case STAGE_WRITING:
+            if (res < 0)
+            {
+                fail_job(batch, job, "could not write output file", job->output, -res);
+                close(job->fd);
+                --ub->writing;
+                return;
+            }
+            job->written += res;
+            if (job->written == job->image_size)
+                job->stage = STAGE_CLOSING;
+            queue_stage(ub, index);
+            break;
+
+        case STAGE_CLOSING:
+            free(job->image);
+            job->image = NULL;
+            job->stage = STAGE_DONE;
+            --ub->writing;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void wait_completions(uring_batch_t* ub)
+{
+    while (uring_submit(&ub->ring, 1) < 0 && errno == EINTR)
+        ;
+
+    struct io_uring_cqe cqe;
+    while (uring_pop_cqe(&ub->ring, &cqe))
+        complete(ub, &cqe);
+}
+
+static int run_uring(batch_t* batch)
+{
+    uring_batch_t ub;
+    // each job in flight has at most two operations, its own and the close of its input
+    if (uring_init(&ub.ring, 4 * BATCH_WINDOW) != 0)
+        return -1;
+    static const uint8_t ops[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE};
+    if (!uring_supports(&ub.ring, ops, sizeof(ops)))
+    {
+        uring_exit(&ub.ring);
+        return -1;
+    }
+    ub.batch = batch;
+    ub.inflight = 0;
+    ub.reading = ub.writing = 0;
+
+    int next_read = 0;
+    int current = 0;
+    while (current < batch->jobs.size || ub.inflight > 0)
+    {
+        while (next_read < batch->jobs.size && next_read < current + BATCH_WINDOW)
+        {
+            batch->jobs.ptr[next_read].stage = STAGE_OPENING;
+            ++ub.reading;
+            queue_stage(&ub, next_read++);
+        }
+
+        if (current < batch->jobs.size)
+        {
+            batch_job_t* job = &batch->jobs.ptr[current];
+            if (job->stage == STAGE_FAILED)
+            {
+                ++current;
+                continue;
+            }
+            if (job->stage == STAGE_READ && ub.writing < BATCH_WINDOW)
+            {
+                // the reads queued so far run while this one is assembled
+                uring_submit(&ub.ring, 0);
+                if (assemble_job(batch, job) != 0)
+                {
+                    ++current;
+                    continue;
+                }
+                job->stage = STAGE_CREATING;
+                ++ub.writing;
+                queue_stage(&ub, current++);
+                continue;
+            }
+        }
+
+        wait_completions(&ub);
+    }
+
+    uring_exit(&ub.ring);
+    return 0;
+}
+
+#endif // HAVE_URING
+
+int assemble_batch(const char* list_file, const asm_options_t* options, batch_io_t io)
+{
+    batch_t batch;
+    batch.options = options;
+    batch.failures = 0;
+    if (read_list(list_file, &batch) != 0)
+        return -1;
+
+    const char* backend = "pread";
+    (void)io;
+#ifdef HAVE_URING
+    if (io == BATCH_IO_AUTO && run_uring(&batch) == 0)
+        backend = "io_uring";
+    else
+#endif
+        run_pread(&batch);
+
+    fprintf(stderr, "%d files assembled with %s, %d failed\n", batch.jobs.size - batch.failures, backend, batch.failures);
+
+    for (int i = 0; i < batch.jobs.size; ++i)
+    {
+        free(batch.jobs.ptr[i].input);
+        free(batch.jobs.ptr[i].output);
+    }
+    free(batch.jobs.ptr);
+
+    return batch.failures;
+}
@@ -0,0 +1,23 @@
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+
+#include "options.h"
+
+// Assembles many files in one run. The list file has one "<input> [output]" line per file,
+// the output defaults to the input name with a ".bin" extension.
+// On Linux the file opens, reads and writes go through io_uring : the sources of the next files are read
+// while the current one is assembled, and finished images are written in the background, with a bounded
+// number of files in flight. Elsewhere, or when io_uring isn't available, files go through open/pread/write.
+// The gain is from staying in one process : with small cached sources the run is bound by assembly,
+// and io_uring isn't measurably faster than open/pread/write.
+
+typedef enum batch_io_t
+{
+    BATCH_IO_AUTO,
+    BATCH_IO_PREAD
+} batch_io_t;
+
+// returns the number of files that failed
+int assemble_batch(const char* list_file, const asm_options_t* options, batch_io_t io);
+
+#endif // BATCH_H_INCLUDED
@@ -0,0 +1,181 @@
+#include "builder.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fatal.h"
+#include "hash.h"
+#include "jump_table.h"
+#include "parser.h"
+#include "pic.h"
+
+static void check_kind(opcode_t op, operand_kind_t kind)
+{
+    if (opcode_infos[op].kind == kind)
+        return;
+    // label addresses can also be used as integer immediates
+    if (kind == OPERAND_1OP_LBL && opcode_infos[op].kind == OPERAND_1OP_I_IMM)
+        return;
+
+    fprintf(stderr, "opcode 0x%02x (%s) can't be used with this operand kind\n",
+            op, opcode_infos[op].name ? opcode_infos[op].name : "invalid");
+    asm_fatal();
+}
+
+// appends the opcode and reserves 'operand_len' bytes, returns the operand offset
+static inline size_t emit_opcode(asm_unit_t* unit, opcode_t op, int operand_len)
+{
+    DYNARRAY_ADD(unit->object_buffer, op);
+    DYNARRAY_RESIZE(unit->object_buffer, unit->object_buffer.size + operand_len);
+
+    return unit->object_buffer.size - operand_len;
+}
+
+void asm_builder_init(asm_unit_t* unit)
+{
+    parse_init(unit);
+    unit->source = NULL;
+}
+
+asm_label_t asm_new_label(asm_unit_t* unit, const char* name)
+{
+    DYNARRAY_ADD(unit->label_handles, (label_handle_t){name ? strdup(name) : NULL, -1});
+
+    return unit->label_handles.size - 1;
+}
+
+void asm_bind_label(asm_unit_t* unit, asm_label_t label)
+{
+    label_handle_t* handle = &unit->label_handles.ptr[label];
+    handle->addr = unit->code_base + unit->object_buffer.size;
+
+    if (handle->name)
+    {
+        uint64_t hash = str_hash(handle->name);
+        hash_table_insert_hashed(&unit->labels, handle->name, hash, (hash_value_t){.idx = handle->addr});
+        if (unit->label_defined)
+            unit->label_defined(unit, handle->name, hash, handle->addr);
+    }
+}
+
+void asm_emit_0op(asm_unit_t* unit, opcode_t op)
+{
+    check_kind(op, OPERAND_0OP);
+    DYNARRAY_ADD(unit->object_buffer, op);
+}
+
+void asm_emit_imm_int(asm_unit_t* unit, opcode_t op, int32_t imm)
+{
+    check_kind(op, OPERAND_1OP_I_IMM);
+    size_t offset = emit_opcode(unit, op, 4);
+    *(int32_t*)(unit->object_buffer.ptr + offset) = imm;
+}
+
+void asm_emit_imm_float(asm_unit_t* unit, opcode_t op, float imm)
+{
+    check_kind(op, OPERAND_1OP_F_IMM);
+    size_t offset = emit_opcode(unit, op, 4);
+    *(float*)(unit->object_buffer.ptr + offset) = imm;
+}
+
+void asm_emit_imm_byte(asm_unit_t* unit, opcode_t op, int8_t imm)
+{
+    check_kind(op, OPERAND_1OP_B_IMM);
+    size_t offset = emit_opcode(unit, op, 1);
+    *(int8_t*)(unit->object_buffer.ptr + offset) = imm;
+}
+
+void asm_emit_var(asm_unit_t* unit, opcode_t op, uint16_t var)
+{
+    check_kind(op, OPERAND_1OP_VAR);
+    size_t offset = emit_opcode(unit, op, 2);
+    *(uint16_t*)(unit->object_buffer.ptr + offset) = var;
+}
+
+void asm_emit_label(asm_unit_t* unit, opcode_t op, asm_label_t label)
+{
+    check_kind(op, OPERAND_1OP_LBL);
+    size_t offset = emit_opcode(unit, op, 4);
+    DYNARRAY_ADD(unit->relocs, (reloc_pair_t){offset, NULL, 0, label});
+    *(uint32_t*)(unit->object_buffer.ptr + offset) = 0xdeadbeef;
+}
+
+void asm_emit_label_name(asm_unit_t* unit, opcode_t op, const char* label, uint64_t hash)
+{
+    check_kind(op, OPERAND_1OP_LBL);
+    size_t offset = emit_opcode(unit, op, 4);
+    DYNARRAY_ADD(unit->relocs, (reloc_pair_t){offset, strdup(label), hash, -1});
+    *(uint32_t*)(unit->object_buffer.ptr + offset) = 0xdeadbeef;
+}
+
+int asm_table(asm_unit_t* unit, const char* name, uint64_t hash)
+{
+    if (name)
+        for (int i = 0; i < unit->tables.size; ++i)
+        {
+            const jump_table_t* table = &unit->tables.ptr[i];
+            if (table->name && table->hash == hash && strcmp(table->name, name) == 0)
+                return i;
+        }
+
+    if (unit->tables.size >= 0x10000)
+    {
+        fprintf(stderr, "too many jump tables (the index doesn't fit in 16-bit)\n");
+        asm_fatal();
+    }
+
+    jump_table_t table;
+    table.name = name ? strdup(name) : NULL;
+    table.hash = hash;
+    table.defined = 0;
+    DYNARRAY_INIT(table.entries, 8);
+    DYNARRAY_ADD(unit->tables, table);
+
+    return unit->tables.size - 1;
+}
+
+void asm_table_add_label(asm_unit_t* unit, int table, asm_label_t label)
+{
+    jump_table_t* tbl = &unit->tables.ptr[table];
+    tbl->defined = 1;
+    DYNARRAY_ADD(tbl->entries, (reloc_pair_t){0, NULL, 0, label});
+}
+
+void asm_table_add_label_name(asm_unit_t* unit, int table, const char* label, uint64_t hash)
+{
+    jump_table_t* tbl = &unit->tables.ptr[table];
+    tbl->defined = 1;
+    DYNARRAY_ADD(tbl->entries, (reloc_pair_t){0, strdup(label), hash, -1});
+}
+
+void asm_emit_table(asm_unit_t* unit, opcode_t op, int table)
+{
+    check_kind(op, OPERAND_1OP_TBL);
+    size_t offset = emit_opcode(unit, op, 2);
+    *(uint16_t*)(unit->object_buffer.ptr + offset) = table;
+}
+
+void asm_add_string(asm_unit_t* unit, unsigned int id, const char* bytes, uint16_t len)
+{
+    char* copy = string_pool_reserve(&unit->string_pool, len + 1);
+    memcpy(copy, bytes, len);
+    copy[len] = '\0';
+    string_pool_commit(&unit->string_pool, len + 1);
+
+    string_constant_t str_entry;
+    str_entry.id = id;
+    str_entry.str = copy;
+    str_entry.len = len;
+
+    DYNARRAY_ADD(unit->strings, str_entry);
+}
+
+void asm_finish(asm_unit_t* unit)
+{
+    if (unit->pic)
+        resolve_relocations_pic(unit);
+    else
+        resolve_relocations(unit);
+    emit_jump_tables(unit);
+    sort_strings(unit);
+}
@@ -0,0 +1,49 @@
+#ifndef BUILDER_H_INCLUDED
+#define BUILDER_H_INCLUDED
+
+#include <stdint.h>
+
+#include "asm_unit_info.h"
+#include "opcodes.h"
+
+/*
+ Binary instruction builder, for front-ends that already hold instructions in structured form.
+ asm_builder_init, then any sequence of asm_emit_* / asm_bind_label / asm_add_string,
+ then asm_finish ; the unit can then be written with write_image.
+ The text parser goes through the same encoders.
+*/
+
+typedef int asm_label_t;
+
+void asm_builder_init(asm_unit_t* unit);
+
+// 'name' can be NULL, named labels are also added to the symbol table (e.g. "_global_init")
+asm_label_t asm_new_label(asm_unit_t* unit, const char* name);
+// binds the label to the current position
+void        asm_bind_label(asm_unit_t* unit, asm_label_t label);
+
+void asm_emit_0op      (asm_unit_t* unit, opcode_t op);
+void asm_emit_imm_int  (asm_unit_t* unit, opcode_t op, int32_t imm);
+void asm_emit_imm_float(asm_unit_t* unit, opcode_t op, float imm);
+void asm_emit_imm_byte (asm_unit_t* unit, opcode_t op, int8_t imm);
+void asm_emit_var      (asm_unit_t* unit, opcode_t op, uint16_t var);
+// jt/jf/jmp/call, or an integer immediate holding the label address (e.g. 'pushi label' for calli)
+void asm_emit_label    (asm_unit_t* unit, opcode_t op, asm_label_t label);
+// same, with a label looked up by name when finishing, 'hash' is str_hash(label)
+void asm_emit_label_name(asm_unit_t* unit, opcode_t op, const char* label, uint64_t hash);
+
+// jump tables (see jump_table.h) : returns the index of the table 'name', declaring it on first use,
+// a NULL name always creates a new table. Entries are appended in order, the table is defined by its first entry
+int  asm_table(asm_unit_t* unit, const char* name, uint64_t hash);
+void asm_table_add_label(asm_unit_t* unit, int table, asm_label_t label);
+void asm_table_add_label_name(asm_unit_t* unit, int table, const char* label, uint64_t hash);
+// jmpt/loadt
+void asm_emit_table(asm_unit_t* unit, opcode_t op, int table);
+
+// the bytes are copied
+void asm_add_string(asm_unit_t* unit, unsigned int id, const char* bytes, uint16_t len);
+
+// resolves the label references and jump tables, and sorts the string table
+void asm_finish(asm_unit_t* unit);
+
+#endif // BUILDER_H_INCLUDED
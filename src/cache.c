@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+
+#include "cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dynarray.h"
+#include "sha256.h"
+
+// temporary files left behind by a killed assembler are removed after this long
+#define STALE_TEMP_SECONDS 3600
+
+typedef struct cache_counters_t
+{
+    uint64_t hits;
+    uint64_t misses;
+} cache_counters_t;
+
+typedef struct cache_entry_t
+{
+    char* path;
+    struct timespec mtime;
+    uint64_t size;
+} cache_entry_t;
+
+static int make_directory(const char* path)
+{
+    if (mkdir(path, 0777) != 0 && errno != EEXIST)
+        return -1;
+    return 0;
+}
+
+int cache_open(output_cache_t* cache, const char* directory, uint64_t size_limit)
+{
+    cache->directory = directory;
+    cache->size_limit = size_limit;
+    cache->key[0] = '\0';
+    cache->entry_path[0] = '\0';
+
+    if (make_directory(directory) != 0)
+    {
+        fprintf(stderr, "could not create cache directory '%s' : %s\n", directory, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+void cache_make_key(output_cache_t* cache, const void* source, size_t len, const asm_options_t* options)
+{
+    sha256_t ctx;
+    sha256_init(&ctx);
+
+    static const char version[] = "DanPaAssembler " ASSEMBLER_VERSION;
+    sha256_update(&ctx, version, sizeof(version));
+
+    // fields one by one, the struct padding isn't part of the key
+    int32_t option_values[] = {options->optimize_cfg, options->frame_info, options->pic, options->const_pool,
+                               options->output_format, options->register_code,
+                               options->inline_size};
+    sha256_update(&ctx, option_values, sizeof(option_values));
+    if (options->symbol_name)
+        sha256_update(&ctx, options->symbol_name, strlen(options->symbol_name) + 1);
+
+    sha256_update(&ctx, source, len);
+
+    uint8_t digest[32];
+    sha256_final(&ctx, digest);
+    for (int i = 0; i < 32; ++i)
+        sprintf(cache->key + i*2, "%02x", digest[i]);
+
+    snprintf(cache->entry_path, sizeof(cache->entry_path), "%s/%.2s/%s", cache->directory, cache->key, cache->key + 2);
+}
+
+// updates the persistent counters under an exclusive lock, count == 0 just reads them
+static cache_counters_t update_counters(output_cache_t* cache, int hit, int count)
+{
+    cache_counters_t counters = {0, 0};
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/stats", cache->directory);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd < 0)
+        return counters;
+    flock(fd, LOCK_EX);
+
+    if (pread(fd, &counters, sizeof(counters), 0) != sizeof(counters))
+        counters.hits = counters.misses = 0;
+    if (count)
+    {
+        if (hit)
+            ++counters.hits;
+        else
+            ++counters.misses;
+        if (pwrite(fd, &counters, sizeof(counters), 0) != sizeof(counters))
+            fprintf(stderr, "warning : could not update the cache counters\n");
+    }
+
+    flock(fd, LOCK_UN);
+    close(fd);
+    return counters;
+}
+
+static int copy_file(const char* from, const char* to)
+{
+    int in = open(from, O_RDONLY);
+    if (in < 0)
+        return -1;
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out < 0)
+    {
+        close(in);
+        return -1;
+    }
+
+    char buffer[65536];
+    ssize_t rd;
+    int result = 0;
+    while ((rd = read(in, buffer, sizeof(buffer))) > 0)
+        if (write(out, buffer, rd) != rd)
+        {
+            result = -1;
+            break;
+        }
+    if (rd < 0)
+        result = -1;
+
+    close(in);
+    if (close(out) != 0)
+        result = -1;
+    return result;
+}
+
+// places 'from' at 'to' atomically : hardlink or copy to a temporary name next to 'to', then rename over it
+static int place_file(const char* from, const char* to, const char* temp_prefix)
+{
+    char temp[PATH_MAX];
+    const char* slash = strrchr(to, '/');
+    int dir_len = slash ? (int)(slash - to + 1) : 0;
+    snprintf(temp, sizeof(temp), "%.*s%s%ld.%s", dir_len, to, temp_prefix, (long)getpid(), slash ? slash + 1 : to);
+
+    unlink(temp);
+    if (link(from, temp) != 0 && copy_file(from, temp) != 0)
+    {
+        unlink(temp);
+        return -1;
+    }
+    int result = rename(temp, to);
+    // renaming a link over another link to the same file succeeds without removing the source
+    unlink(temp);
+
+    return result;
+}
+
+int cache_fetch(output_cache_t* cache, const char* out_name)
+{
+    int hit = access(cache->entry_path, R_OK) == 0 && place_file(cache->entry_path, out_name, ".dpa-tmp.") == 0;
+    if (hit)
+        utimensat(AT_FDCWD, cache->entry_path, NULL, 0);
+
+    update_counters(cache, hit, 1);
+    return hit;
+}
+
+static int entry_cmp(const void* vlhs, const void* vrhs)
+{
+    const cache_entry_t* lhs = vlhs;
+    const cache_entry_t* rhs = vrhs;
+
+    if (lhs->mtime.tv_sec != rhs->mtime.tv_sec)
+        return (lhs->mtime.tv_sec > rhs->mtime.tv_sec) - (lhs->mtime.tv_sec < rhs->mtime.tv_sec);
+    return (lhs->mtime.tv_nsec > rhs->mtime.tv_nsec) - (lhs->mtime.tv_nsec < rhs->mtime.tv_nsec);
+}
+
+// lists the entries of every <dir>/xx subdirectory, removing stale temporaries on the way
+static uint64_t scan_entries(output_cache_t* cache, void* ventries)
+{
+    DYNARRAY(cache_entry_t)* entries = ventries;
+    uint64_t total = 0;
+    time_t now = time(NULL);
+
+    DIR* root = opendir(cache->directory);
+    if (!root)
+        return 0;
+
+    struct dirent* sub;
+    while ((sub = readdir(root)))
+    {
+        if (strlen(sub->d_name) != 2 || sub->d_name[0] == '.')
+            continue;
+
+        char sub_path[PATH_MAX];
+        if (snprintf(sub_path, sizeof(sub_path), "%s/%s", cache->directory, sub->d_name) >= (int)sizeof(sub_path))
+            continue;
+        DIR* dir = opendir(sub_path);
+        if (!dir)
+            continue;
+
+        struct dirent* ent;
+        while ((ent = readdir(dir)))
+        {
+            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+                continue;
+
+            // too long paths aren't entries written by the cache
+            char path[PATH_MAX];
+            if (snprintf(path, sizeof(path), "%s/%s", sub_path, ent->d_name) >= (int)sizeof(path))
+                continue;
+            struct stat st;
+            if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+                continue;
+
+            if (ent->d_name[0] == '.')
+            {
+                if (now - st.st_mtime > STALE_TEMP_SECONDS)
+                    unlink(path);
+                continue;
+            }
+
+            total += st.st_size;
+            if (entries)
+                DYNARRAY_ADD(*entries, (cache_entry_t){strdup(path), st.st_mtim, st.st_size});
+        }
+        closedir(dir);
+    }
+    closedir(root);
+
+    return total;
+}
+
+static void evict(output_cache_t* cache)
+{
+    DYNARRAY(cache_entry_t) entries;
+    DYNARRAY_INIT(entries, 256);
+
+    uint64_t total = scan_entries(cache, &entries);
+    if (total > cache->size_limit)
+    {
+        qsort(entries.ptr, entries.size, sizeof(cache_entry_t), entry_cmp);
+        for (int i = 0; i < entries.size && total > cache->size_limit; ++i)
+            if (unlink(entries.ptr[i].path) == 0)
+                total -= entries.ptr[i].size;
+    }
+
+    for (int i = 0; i < entries.size; ++i)
+        free(entries.ptr[i].path);
+    free(entries.ptr);
+}
+
+void cache_store(output_cache_t* cache, const char* out_name)
+{
+    char sub_path[PATH_MAX];
+    snprintf(sub_path, sizeof(sub_path), "%s/%.2s", cache->directory, cache->key);
+    if (make_directory(sub_path) != 0 || place_file(out_name, cache->entry_path, ".") != 0)
+    {
+        fprintf(stderr, "warning : could not store '%s' in the cache : %s\n", out_name, strerror(errno));
+        return;
+    }
+
+    evict(cache);
+}
+
+void cache_print_stats(output_cache_t* cache, FILE* out)
+{
+    cache_counters_t counters = update_counters(cache, 0, 0);
+    uint64_t total = scan_entries(cache, NULL);
+
+    fprintf(out, "cache : %llu hits, %llu misses, %llu bytes (limit %llu)\n",
+            (unsigned long long)counters.hits, (unsigned long long)counters.misses,
+            (unsigned long long)total, (unsigned long long)cache->size_limit);
+}
+
+void detach_output(const char* path)
+{
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink > 1)
+        unlink(path);
+}
@@ -0,0 +1,38 @@
+#ifndef CACHE_H_INCLUDED
+#define CACHE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <limits.h>
+
+#include "options.h"
+
+// Content-addressed cache of assembled images.
+// Entries are keyed by the SHA-256 of the assembler version, the options and the source bytes, and live in
+// <dir>/<first two hex digits>/<rest of the digest>. They are written to a temporary file and renamed into
+// place, so concurrent assemblers never see a partial entry ; two writers of the same key store the same bytes.
+// A hit hardlinks the entry to the output (or copies it across filesystems) and refreshes its mtime,
+// which eviction uses as the LRU order.
+
+typedef struct output_cache_t
+{
+    const char* directory;
+    uint64_t size_limit; // bytes, entries are evicted oldest first above it
+    char key[65];
+    char entry_path[PATH_MAX];
+} output_cache_t;
+
+// creates the directory if needed, returns 0 on success
+int  cache_open(output_cache_t* cache, const char* directory, uint64_t size_limit);
+void cache_make_key(output_cache_t* cache, const void* source, size_t len, const asm_options_t* options);
+// puts the cached image in place of 'out_name', returns 1 on a hit ; counts the hit or the miss
+int  cache_fetch(output_cache_t* cache, const char* out_name);
+// stores the freshly written 'out_name' under the current key, then evicts down to the size limit
+void cache_store(output_cache_t* cache, const char* out_name);
+void cache_print_stats(output_cache_t* cache, FILE* out);
+
+// an output hardlinked to a cache entry must be unlinked before being rewritten, or the entry would change with it
+void detach_output(const char* path);
+
+#endif // CACHE_H_INCLUDED
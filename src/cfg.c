@@ -0,0 +1,72 @@
+#include "cfg.h"
+
+#include <string.h>
+
+void cfg_build(const ir_program_t* prog, cfg_t* cfg)
+{
+    int count = prog->ins.size;
+    DYNARRAY_INIT(cfg->blocks, 64);
+
+    // leaders, and function entries
+    uint8_t* leader = calloc(count + 1, 1);
+    uint8_t* function_start = calloc(count + 1, 1);
+    leader[0] = 1;
+    for (int i = 0; i < prog->labels.size; ++i)
+    {
+        const ir_label_t* label = &prog->labels.ptr[i];
+        if (label->pos < 0)
+            continue;
+        leader[label->pos] = 1;
+        if (ir_label_is_global(label))
+            function_start[label->pos] = 1;
+    }
+    for (int i = 0; i < count; ++i)
+        if (ir_is_terminator(prog->ins.ptr[i].op))
+            leader[i + 1] = 1;
+
+    cfg->block_at = malloc((count + 1) * sizeof(int));
+    int function = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        cfg->block_at[i] = -1;
+        if (!leader[i])
+            continue;
+
+        if (function_start[i] && i != 0)
+            ++function;
+        if (cfg->blocks.size)
+            cfg->blocks.ptr[cfg->blocks.size - 1].end = i;
+        cfg->block_at[i] = cfg->blocks.size;
+        DYNARRAY_ADD(cfg->blocks, (basic_block_t){i, count, -1, -1, function});
+    }
+    cfg->block_at[count] = -1;
+    cfg->function_count = count ? function + 1 : 0;
+
+    cfg->label_block = malloc((prog->labels.size + 1) * sizeof(int));
+    for (int i = 0; i < prog->labels.size; ++i)
+    {
+        int pos = prog->labels.ptr[i].pos;
+        cfg->label_block[i] = pos < 0 ? -1 : cfg->block_at[pos];
+    }
+
+    for (int i = 0; i < cfg->blocks.size; ++i)
+    {
+        basic_block_t* block = &cfg->blocks.ptr[i];
+        const ir_ins_t* last = &prog->ins.ptr[block->end - 1];
+
+        if (ir_is_branch(last->op))
+            block->branch = cfg->label_block[last->target];
+        if (last->op != OP_jmp && last->op != OP_jmpt && last->op != OP_ret && i + 1 < cfg->blocks.size)
+            block->fallthrough = i + 1;
+    }
+
+    free(leader);
+    free(function_start);
+}
+
+void cfg_free(cfg_t* cfg)
+{
+    free(cfg->blocks.ptr);
+    free(cfg->block_at);
+    free(cfg->label_block);
+}
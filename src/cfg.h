@@ -0,0 +1,29 @@
+#ifndef CFG_H_INCLUDED
+#define CFG_H_INCLUDED
+
+#include "ir.h"
+
+// Basic blocks of an ir_program_t. Blocks start at labels and after jt/jf/jmp/jmpt/ret ;
+// 'call' isn't a block boundary since it returns to the next instruction.
+// The successors of a 'jmpt' are the labels of its table, they aren't stored in the block.
+
+typedef struct basic_block_t
+{
+    int start, end; // instruction range [start, end)
+    int branch;     // block targeted by the final jt/jf/jmp, -1 if none
+    int fallthrough;// next block when the last instruction doesn't end the flow, -1 if none
+    int function;   // index of the enclosing function, see cfg_t
+} basic_block_t;
+
+typedef struct cfg_t
+{
+    DYNARRAY(basic_block_t) blocks;
+    int* block_at;      // block starting at each instruction index (and at the end), -1 otherwise
+    int* label_block;   // block of each label, -1 for undefined labels or labels at the very end
+    int function_count; // functions are delimited by global labels, code before the first one is function 0
+} cfg_t;
+
+void cfg_build(const ir_program_t* prog, cfg_t* cfg);
+void cfg_free(cfg_t* cfg);
+
+#endif // CFG_H_INCLUDED
@@ -0,0 +1,268 @@
+#include "cfg_opt.h"
+
+#include <string.h>
+
+#include "cfg.h"
+
+#define MAX_THREAD_HOPS 16
+
+// follows the chain of 'jmp' starting at 'label'
+static int thread_target(const ir_program_t* prog, int label)
+{
+    for (int hops = 0; hops < MAX_THREAD_HOPS; ++hops)
+    {
+        int pos = prog->labels.ptr[label].pos;
+        if (pos < 0 || pos >= prog->ins.size)
+            break;
+        const ir_ins_t* ins = &prog->ins.ptr[pos];
+        if (ins->op != OP_jmp || ins->target == label)
+            break;
+        label = ins->target;
+    }
+
+    return label;
+}
+
+static void thread_jumps(ir_program_t* prog)
+{
+    for (int i = 0; i < prog->ins.size; ++i)
+    {
+        ir_ins_t* ins = &prog->ins.ptr[i];
+        if (ins->target < 0 || (!ir_is_branch(ins->op) && ins->op != OP_call))
+            continue;
+
+        ins->target = thread_target(prog, ins->target);
+
+        // jmp to a ret
+        int pos = prog->labels.ptr[ins->target].pos;
+        if (ins->op == OP_jmp && pos >= 0 && pos < prog->ins.size && prog->ins.ptr[pos].op == OP_ret)
+        {
+            ins->op = OP_ret;
+            ins->target = -1;
+        }
+    }
+
+    for (int i = 0; i < prog->tables.size; ++i)
+        for (int j = 0; j < prog->tables.ptr[i].labels.size; ++j)
+            prog->tables.ptr[i].labels.ptr[j] = thread_target(prog, prog->tables.ptr[i].labels.ptr[j]);
+}
+
+static uint8_t* labeled_positions(const ir_program_t* prog)
+{
+    uint8_t* labeled = calloc(prog->ins.size + 1, 1);
+    for (int i = 0; i < prog->labels.size; ++i)
+        if (prog->labels.ptr[i].pos >= 0)
+            labeled[prog->labels.ptr[i].pos] = 1;
+
+    return labeled;
+}
+
+// 'jt A; jmp B; A:' -> 'jf B; A:'
+static void invert_branches_over_jumps(ir_program_t* prog)
+{
+    uint8_t* labeled = labeled_positions(prog);
+    uint8_t* dead = calloc(prog->ins.size + 1, 1);
+
+    for (int i = 0; i + 1 < prog->ins.size; ++i)
+    {
+        ir_ins_t* cond = &prog->ins.ptr[i];
+        const ir_ins_t* jump = &prog->ins.ptr[i + 1];
+        if ((cond->op != OP_jt && cond->op != OP_jf) || jump->op != OP_jmp || labeled[i + 1] || dead[i])
+            continue;
+        if (prog->labels.ptr[cond->target].pos != i + 2)
+            continue;
+
+        cond->op = (cond->op == OP_jt) ? OP_jf : OP_jt;
+        cond->target = jump->target;
+        dead[i + 1] = 1;
+    }
+
+    ir_remove_instructions(prog, dead);
+    free(dead);
+    free(labeled);
+}
+
+static void remove_jumps_to_next(ir_program_t* prog)
+{
+    uint8_t* dead = calloc(prog->ins.size + 1, 1);
+    for (int i = 0; i < prog->ins.size; ++i)
+    {
+        const ir_ins_t* ins = &prog->ins.ptr[i];
+        if (ins->op == OP_jmp && prog->labels.ptr[ins->target].pos == i + 1)
+            dead[i] = 1;
+    }
+
+    ir_remove_instructions(prog, dead);
+    free(dead);
+}
+
+static uint8_t* reachable_blocks(const ir_program_t* prog, const cfg_t* cfg)
+{
+    int count = cfg->blocks.size;
+    uint8_t* reachable = calloc(count + 1, 1);
+    int* stack = malloc((count + 1) * sizeof(int));
+    int top = 0;
+
+#define PUSH_BLOCK(b) \
+    do { int blk = (b); if (blk >= 0 && !reachable[blk]) { reachable[blk] = 1; stack[top++] = blk; } } while (0)
+
+    if (count)
+        PUSH_BLOCK(0);
+    // functions can be entered from outside of the unit
+    for (int i = 0; i < prog->labels.size; ++i)
+        if (ir_label_is_global(&prog->labels.ptr[i]))
+            PUSH_BLOCK(cfg->label_block[i]);
+    // call targets and address-taken labels, even from dead code, and jump table entries
+    for (int i = 0; i < prog->ins.size; ++i)
+    {
+        const ir_ins_t* ins = &prog->ins.ptr[i];
+        if (ins->target >= 0 && !ir_is_branch(ins->op))
+            PUSH_BLOCK(cfg->label_block[ins->target]);
+    }
+    for (int i = 0; i < prog->tables.size; ++i)
+        for (int j = 0; j < prog->tables.ptr[i].labels.size; ++j)
+            PUSH_BLOCK(cfg->label_block[prog->tables.ptr[i].labels.ptr[j]]);
+
+    while (top)
+    {
+        const basic_block_t* block = &cfg->blocks.ptr[stack[--top]];
+        PUSH_BLOCK(block->branch);
+        PUSH_BLOCK(block->fallthrough);
+    }
+
+#undef PUSH_BLOCK
+
+    free(stack);
+    return reachable;
+}
+
+static int falls_into(const cfg_t* cfg, const uint8_t* reachable, int block)
+{
+    return block > 0 && reachable[block - 1] && cfg->blocks.ptr[block - 1].fallthrough == block
+            && cfg->blocks.ptr[block - 1].function == cfg->blocks.ptr[block].function;
+}
+
+// places the chain of fallthrough blocks starting at 'head', returns its last block
+static int place_chain(const cfg_t* cfg, int head, int* order, int* order_size, uint8_t* placed)
+{
+    int block = head;
+    for (;;)
+    {
+        order[(*order_size)++] = block;
+        placed[block] = 1;
+
+        const basic_block_t* blk = &cfg->blocks.ptr[block];
+        if (blk->fallthrough != block + 1 || cfg->blocks.ptr[block + 1].function != blk->function)
+            return block;
+        ++block;
+    }
+}
+
+// drops unreachable blocks, and reorders the rest so that 'jmp' targets directly follow the jump
+static void layout_blocks(ir_program_t* prog)
+{
+    cfg_t cfg;
+    cfg_build(prog, &cfg);
+
+    int count = cfg.blocks.size;
+    uint8_t* reachable = reachable_blocks(prog, &cfg);
+    uint8_t* placed = calloc(count + 1, 1);
+    int* order = malloc((count + 1) * sizeof(int));
+    int order_size = 0;
+
+    for (int first = 0; first < count; )
+    {
+        int function = cfg.blocks.ptr[first].function;
+        int last = first;
+        while (last + 1 < count && cfg.blocks.ptr[last + 1].function == function)
+            ++last;
+
+        // a function falling through into the next one keeps its last chain at the end
+        int tail_head = -1;
+        if (reachable[last] && cfg.blocks.ptr[last].fallthrough != -1)
+        {
+            tail_head = last;
+            while (falls_into(&cfg, reachable, tail_head))
+                --tail_head;
+        }
+
+        int scan = first;
+        int current = reachable[first] ? first : -1;
+        for (;;)
+        {
+            while (current < 0 && scan <= last)
+            {
+                if (reachable[scan] && !placed[scan] && scan != tail_head && !falls_into(&cfg, reachable, scan))
+                    current = scan;
+                ++scan;
+            }
+            if (current < 0)
+                break;
+
+            int end = place_chain(&cfg, current, order, &order_size, placed);
+            current = -1;
+
+            const basic_block_t* blk = &cfg.blocks.ptr[end];
+            int target = blk->branch;
+            if (prog->ins.ptr[blk->end - 1].op == OP_jmp && target >= first && target <= last
+                && !placed[target] && target != tail_head && !falls_into(&cfg, reachable, target))
+                current = target;
+        }
+        if (tail_head >= 0 && !placed[tail_head])
+            place_chain(&cfg, tail_head, order, &order_size, placed);
+
+        first = last + 1;
+    }
+
+    // rebuild the instruction list in the new order
+    ir_ins_t* new_ins = malloc((prog->ins.size + 1) * sizeof(ir_ins_t));
+    int* new_start = malloc((count + 1) * sizeof(int));
+    int size = 0;
+    for (int i = 0; i < order_size; ++i)
+    {
+        const basic_block_t* blk = &cfg.blocks.ptr[order[i]];
+        new_start[order[i]] = size;
+        memcpy(new_ins + size, prog->ins.ptr + blk->start, (blk->end - blk->start) * sizeof(ir_ins_t));
+        size += blk->end - blk->start;
+    }
+    // labels of dropped blocks aren't referenced anymore, move them to the next kept block
+    int next_start = size;
+    for (int i = count - 1; i >= 0; --i)
+    {
+        if (placed[i])
+            next_start = new_start[i];
+        else
+            new_start[i] = next_start;
+    }
+
+    for (int i = 0; i < prog->labels.size; ++i)
+    {
+        ir_label_t* label = &prog->labels.ptr[i];
+        if (label->pos < 0)
+            continue;
+        label->pos = (label->pos == prog->ins.size) ? size : new_start[cfg.block_at[label->pos]];
+    }
+
+    free(prog->ins.ptr);
+    prog->ins.ptr = new_ins;
+    prog->ins.size = size;
+    prog->ins.capacity = prog->ins.size + 1;
+
+    free(new_start);
+    free(order);
+    free(placed);
+    free(reachable);
+    cfg_free(&cfg);
+}
+
+void optimize_cfg(ir_program_t* prog)
+{
+    if (prog->ins.size == 0)
+        return;
+
+    thread_jumps(prog);
+    invert_branches_over_jumps(prog);
+    layout_blocks(prog);
+    remove_jumps_to_next(prog);
+    invert_branches_over_jumps(prog);
+}
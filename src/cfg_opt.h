@@ -0,0 +1,11 @@
+#ifndef CFG_OPT_H_INCLUDED
+#define CFG_OPT_H_INCLUDED
+
+#include "ir.h"
+
+// Jump threading, inversion of conditional jumps over a 'jmp', unreachable block removal,
+// and block layout so that 'jmp' targets fall through when possible.
+// Blocks are only reordered inside their function.
+void optimize_cfg(ir_program_t* prog);
+
+#endif // CFG_OPT_H_INCLUDED
@@ -0,0 +1,124 @@
+#include "const_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+#include "opcodes.h"
+
+#define POOL_ENTRY_SIZE   5  // type byte and value
+#define POOL_FIXED_COST   12 // section header, entry count and section count
+#define POOL_NARROW_COUNT 256
+#define POOL_MAX_COUNT    65535 // the entry count is 16-bit
+
+typedef struct pool_key_t
+{
+    uint64_t key;   // type << 32 | value bits
+    int count;
+    int index;      // in the pool, -1 if not pooled
+} pool_key_t;
+
+static int is_candidate(const ir_ins_t* ins)
+{
+    return (ins->op == OP_pushi && ins->target < 0) || ins->op == OP_pushf;
+}
+
+static uint64_t make_key(const ir_ins_t* ins)
+{
+    uint32_t bits;
+    memcpy(&bits, &ins->operand, sizeof(bits));
+    return (uint64_t)(ins->op == OP_pushf) << 32 | bits;
+}
+
+static int key_cmp(const void* vlhs, const void* vrhs)
+{
+    const pool_key_t* lhs = vlhs;
+    const pool_key_t* rhs = vrhs;
+
+    return (lhs->key > rhs->key) - (lhs->key < rhs->key);
+}
+
+static int count_cmp(const void* vlhs, const void* vrhs)
+{
+    const pool_key_t* lhs = *(pool_key_t* const*)vlhs;
+    const pool_key_t* rhs = *(pool_key_t* const*)vrhs;
+
+    if (lhs->count != rhs->count)
+        return rhs->count - lhs->count;
+    return (lhs->key > rhs->key) - (lhs->key < rhs->key);
+}
+
+void pool_constants(ir_program_t* prog, asm_unit_t* unit)
+{
+    pool_key_t* keys = malloc((prog->ins.size + 1) * sizeof(pool_key_t));
+    int key_count = 0;
+    for (int i = 0; i < prog->ins.size; ++i)
+        if (is_candidate(&prog->ins.ptr[i]))
+            keys[key_count++] = (pool_key_t){make_key(&prog->ins.ptr[i]), 1, -1};
+
+    // run-length count of the sorted keys
+    qsort(keys, key_count, sizeof(pool_key_t), key_cmp);
+    int unique = 0;
+    for (int i = 0; i < key_count; ++i)
+    {
+        if (unique && keys[unique - 1].key == keys[i].key)
+            ++keys[unique - 1].count;
+        else
+            keys[unique++] = keys[i];
+    }
+
+    pool_key_t** ranked = malloc((unique + 1) * sizeof(pool_key_t*));
+    for (int i = 0; i < unique; ++i)
+        ranked[i] = &keys[i];
+    qsort(ranked, unique, sizeof(pool_key_t*), count_cmp);
+
+    // a pushi/pushf is 5 bytes, pushk 2 and pushkw 3
+    int pooled = 0;
+    long saved = 0;
+    for (; pooled < unique && pooled < POOL_MAX_COUNT; ++pooled)
+    {
+        int width = pooled < POOL_NARROW_COUNT ? 2 : 3;
+        long saving = (long)ranked[pooled]->count * (5 - width) - POOL_ENTRY_SIZE;
+        if (saving <= 0)
+            break;
+        saved += saving;
+        ranked[pooled]->index = pooled;
+    }
+
+    if (pooled > 0 && saved > POOL_FIXED_COST)
+    {
+        for (int i = 0; i < prog->ins.size; ++i)
+        {
+            ir_ins_t* ins = &prog->ins.ptr[i];
+            if (!is_candidate(ins))
+                continue;
+
+            pool_key_t needle = {make_key(ins), 0, 0};
+            const pool_key_t* key = bsearch(&needle, keys, unique, sizeof(pool_key_t), key_cmp);
+            if (key->index < 0)
+                continue;
+
+            if (key->index < POOL_NARROW_COUNT)
+            {
+                ins->op = OP_pushk;
+                ins->operand.i = (int8_t)key->index;
+            }
+            else
+            {
+                ins->op = OP_pushkw;
+                ins->operand.var = key->index;
+            }
+        }
+
+        image_section_t* section = image_add_section(unit, "KPOL");
+        image_section_put_u16(section, pooled);
+        for (int i = 0; i < pooled; ++i)
+        {
+            DYNARRAY_ADD(section->data, (uint8_t)(ranked[i]->key >> 32));
+            image_section_put_u32(section, (uint32_t)ranked[i]->key);
+        }
+    }
+
+    free(ranked);
+    free(keys);
+}
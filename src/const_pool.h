@@ -0,0 +1,20 @@
+#ifndef CONST_POOL_H_INCLUDED
+#define CONST_POOL_H_INCLUDED
+
+#include "asm_unit_info.h"
+#include "ir.h"
+
+/*
+ Immediate constant pool.
+ Repeated pushi/pushf immediates are interned into a "KPOL" image section :
+   uint16_t count, then for each constant : uint8_t type (0 int, 1 float), uint32_t value
+ and the pushes become 'pushk #index' (8-bit index) or 'pushkw index' (16-bit index).
+ A constant is pooled only when that makes the unit smaller : the most frequent constants get the 8-bit
+ indices, and each one must save more code bytes than its 5 byte pool entry costs.
+ Label addresses aren't pooled.
+*/
+
+// rewrites 'prog' and adds the section to 'unit', does nothing if no constant is worth it
+void pool_constants(ir_program_t* prog, asm_unit_t* unit);
+
+#endif // CONST_POOL_H_INCLUDED
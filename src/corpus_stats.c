@@ -0,0 +1,600 @@
+#define _XOPEN_SOURCE 700
+
+#include "corpus_stats.h"
+
+#include <ftw.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cfg.h"
+#include "dynarray.h"
+#include "fatal.h"
+#include "hash_table.h"
+#include "ir.h"
+#include "opcodes.h"
+#include "parser.h"
+
+#define MAX_STATS_THREADS 64
+
+// opcodes are renumbered densely so that the trigram table stays small
+static int dense_count;
+static int dense_of[256];
+static opcode_t op_of_dense[256];
+
+typedef struct operand_count_t
+{
+    uint64_t key; // opcode << 32 | operand bits, 0 for an empty slot (there is no opcode 0)
+    uint64_t weight;
+} operand_count_t;
+
+typedef struct stats_t
+{
+    uint64_t files, instructions, failures;
+    uint64_t* unigrams;
+    uint64_t* bigrams;
+    uint64_t* trigrams;
+    operand_count_t* operands; // open addressing
+    size_t operand_capacity, operand_count;
+} stats_t;
+
+typedef struct profile_entry_t
+{
+    uint32_t offset;
+    uint64_t count;
+} profile_entry_t;
+
+typedef struct file_profile_t
+{
+    DYNARRAY(profile_entry_t) entries;
+} file_profile_t;
+
+typedef struct stats_job_t
+{
+    const stats_options_t* options;
+    hash_table_t profiles; // relative path -> file_profile_t
+    int has_profile;
+    int next_file;
+    stats_t stats[MAX_STATS_THREADS];
+} stats_job_t;
+
+// nftw has no user pointer
+static DYNARRAY(char*) corpus_files;
+static size_t corpus_root_len;
+
+static int collect_file(const char* path, const struct stat* sb, int type, struct FTW* ftwbuf)
+{
+    (void)sb; (void)ftwbuf;
+    size_t len = strlen(path);
+    if (type == FTW_F && len > 4 && strcmp(path + len - 4, ".dpa") == 0)
+        DYNARRAY_ADD(corpus_files, strdup(path));
+
+    return 0;
+}
+
+static const char* relative_path(const char* path)
+{
+    path += corpus_root_len;
+    while (*path == '/')
+        ++path;
+    return path;
+}
+
+static void init_stats(stats_t* stats)
+{
+    memset(stats, 0, sizeof(stats_t));
+    stats->unigrams = calloc(dense_count, sizeof(uint64_t));
+    stats->bigrams  = calloc(dense_count * dense_count, sizeof(uint64_t));
+    stats->trigrams = calloc(dense_count * dense_count * dense_count, sizeof(uint64_t));
+    stats->operand_capacity = 1024;
+    stats->operands = calloc(stats->operand_capacity, sizeof(operand_count_t));
+}
+
+static void free_stats(stats_t* stats)
+{
+    free(stats->unigrams);
+    free(stats->bigrams);
+    free(stats->trigrams);
+    free(stats->operands);
+}
+
+static void add_operand(stats_t* stats, uint64_t key, uint64_t weight);
+
+static void grow_operands(stats_t* stats)
+{
+    operand_count_t* old = stats->operands;
+    size_t old_capacity = stats->operand_capacity;
+
+    stats->operand_capacity *= 2;
+    stats->operands = calloc(stats->operand_capacity, sizeof(operand_count_t));
+    stats->operand_count = 0;
+    for (size_t i = 0; i < old_capacity; ++i)
+        if (old[i].key)
+            add_operand(stats, old[i].key, old[i].weight);
+
+    free(old);
+}
+
+static void add_operand(stats_t* stats, uint64_t key, uint64_t weight)
+{
+    if (stats->operand_count*2 >= stats->operand_capacity)
+        grow_operands(stats);
+
+    size_t mask = stats->operand_capacity - 1;
+    size_t idx = (key * 0x9E3779B97F4A7C15ull) >> 20 & mask;
+    while (stats->operands[idx].key && stats->operands[idx].key != key)
+        idx = (idx + 1) & mask;
+
+    if (!stats->operands[idx].key)
+    {
+        stats->operands[idx].key = key;
+        ++stats->operand_count;
+    }
+    stats->operands[idx].weight += weight;
+}
+
+static char* read_whole_file(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    if (size < 0)
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    char* buffer = malloc(size + 1);
+    size_t rd = fread(buffer, 1, size, file);
+    buffer[rd] = '\0';
+    fclose(file);
+
+    return buffer;
+}
+
+static int profile_entry_cmp(const void* vlhs, const void* vrhs)
+{
+    const profile_entry_t* lhs = vlhs;
+    const profile_entry_t* rhs = vrhs;
+
+    return (lhs->offset > rhs->offset) - (lhs->offset < rhs->offset);
+}
+
+static uint64_t profile_count(const file_profile_t* profile, uint32_t offset)
+{
+    int lo = 0, hi = profile->entries.size;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (profile->entries.ptr[mid].offset < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < profile->entries.size && profile->entries.ptr[lo].offset == offset)
+        return profile->entries.ptr[lo].count;
+    return 0;
+}
+
+static void process_file(stats_job_t* job, stats_t* stats, const char* path)
+{
+    char* source = read_whole_file(path);
+    if (!source)
+    {
+        fprintf(stderr, "could not read '%s'\n", path);
+        ++stats->failures;
+        return;
+    }
+
+    const file_profile_t* profile = NULL;
+    if (job->has_profile)
+    {
+        hash_value_t* val = hash_table_get(&job->profiles, relative_path(path));
+        profile = val ? val->ptr : NULL;
+    }
+
+    asm_unit_t unit;
+    parse_init(&unit);
+    unit.source = source;
+
+    // a malformed file is skipped, and counted with the unreadable ones
+    jmp_buf recovery;
+    if (setjmp(recovery))
+    {
+        asm_recovery_point = NULL;
+        fprintf(stderr, "skipping '%s'\n", path);
+        ++stats->failures;
+        free_asm_unit(&unit);
+        free(source);
+        return;
+    }
+    asm_recovery_point = &recovery;
+    parse_source(&unit, source);
+
+    ir_program_t prog;
+    ir_lift(&unit, &prog);
+    asm_recovery_point = NULL;
+    cfg_t cfg;
+    cfg_build(&prog, &cfg);
+
+    // weight of each instruction, the execution count of its code offset when profiling
+    uint64_t* weight = malloc((prog.ins.size + 1) * sizeof(uint64_t));
+    uint32_t offset = 0;
+    for (int i = 0; i < prog.ins.size; ++i)
+    {
+        weight[i] = job->has_profile ? (profile ? profile_count(profile, offset) : 0) : 1;
+        offset += 1 + operand_size(opcode_infos[prog.ins.ptr[i].op].kind);
+    }
+
+    for (int b = 0; b < cfg.blocks.size; ++b)
+    {
+        const basic_block_t* block = &cfg.blocks.ptr[b];
+        for (int i = block->start; i < block->end; ++i)
+        {
+            const ir_ins_t* ins = &prog.ins.ptr[i];
+            uint64_t w = weight[i];
+            int d0 = dense_of[ins->op];
+
+            stats->unigrams[d0] += w;
+            if (i + 1 < block->end)
+            {
+                int d1 = dense_of[prog.ins.ptr[i + 1].op];
+                stats->bigrams[d0*dense_count + d1] += w;
+                if (i + 2 < block->end)
+                {
+                    int d2 = dense_of[prog.ins.ptr[i + 2].op];
+                    stats->trigrams[(d0*dense_count + d1)*dense_count + d2] += w;
+                }
+            }
+
+            operand_kind_t kind = opcode_infos[ins->op].kind;
+            if (kind != OPERAND_0OP && kind != OPERAND_1OP_LBL && ins->target < 0 && w)
+                add_operand(stats, ((uint64_t)ins->op << 32) | (uint32_t)ins->operand.i, w);
+        }
+    }
+
+    stats->instructions += prog.ins.size;
+    ++stats->files;
+
+    free(weight);
+    cfg_free(&cfg);
+    ir_free(&prog);
+    free_asm_unit(&unit);
+    free(source);
+}
+
+typedef struct worker_arg_t
+{
+    stats_job_t* job;
+    int index;
+} worker_arg_t;
+
+static void* stats_worker(void* varg)
+{
+    worker_arg_t* arg = varg;
+    stats_job_t* job = arg->job;
+
+    for (;;)
+    {
+        int idx = __atomic_fetch_add(&job->next_file, 1, __ATOMIC_RELAXED);
+        if (idx >= corpus_files.size)
+            break;
+        process_file(job, &job->stats[arg->index], corpus_files.ptr[idx]);
+    }
+
+    return NULL;
+}
+
+static int load_profile(stats_job_t* job, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "could not open profile '%s'\n", path);
+        return -1;
+    }
+
+    job->profiles = mk_hash_table(257);
+    char line[4096];
+    while (fgets(line, sizeof(line), file))
+    {
+        char* comma2 = strrchr(line, ',');
+        if (!comma2)
+            continue;
+        *comma2 = '\0';
+        char* comma1 = strrchr(line, ',');
+        if (!comma1)
+            continue;
+        *comma1 = '\0';
+
+        profile_entry_t entry;
+        entry.offset = strtoul(comma1 + 1, NULL, 0);
+        entry.count = strtoull(comma2 + 1, NULL, 10);
+
+        hash_value_t* val = hash_table_get(&job->profiles, line);
+        if (!val)
+        {
+            file_profile_t* profile = malloc(sizeof(file_profile_t));
+            DYNARRAY_INIT(profile->entries, 64);
+            hash_table_insert(&job->profiles, strdup(line), (hash_value_t){.ptr = profile});
+            val = hash_table_get(&job->profiles, line);
+        }
+        file_profile_t* profile = val->ptr;
+        DYNARRAY_ADD(profile->entries, entry);
+    }
+    fclose(file);
+
+    for (size_t i = 0; i < job->profiles.bucket_count; ++i)
+        for (hash_node_t* node = job->profiles.buckets[i]; node; node = node->next_node)
+        {
+            file_profile_t* profile = node->value.ptr;
+            qsort(profile->entries.ptr, profile->entries.size, sizeof(profile_entry_t), profile_entry_cmp);
+        }
+
+    return 0;
+}
+
+static void free_profile(hash_node_t* node)
+{
+    file_profile_t* profile = node->value.ptr;
+    free(profile->entries.ptr);
+    free(profile);
+    free((void*)node->key);
+}
+
+static void merge_stats(stats_t* into, const stats_t* from)
+{
+    into->files += from->files;
+    into->instructions += from->instructions;
+    into->failures += from->failures;
+    for (int i = 0; i < dense_count; ++i)
+        into->unigrams[i] += from->unigrams[i];
+    for (int i = 0; i < dense_count*dense_count; ++i)
+        into->bigrams[i] += from->bigrams[i];
+    for (int i = 0; i < dense_count*dense_count*dense_count; ++i)
+        into->trigrams[i] += from->trigrams[i];
+    for (size_t i = 0; i < from->operand_capacity; ++i)
+        if (from->operands[i].key)
+            add_operand(into, from->operands[i].key, from->operands[i].weight);
+}
+
+typedef struct ranked_t
+{
+    uint64_t weight;
+    uint64_t key;
+} ranked_t;
+
+static int ranked_cmp(const void* vlhs, const void* vrhs)
+{
+    const ranked_t* lhs = vlhs;
+    const ranked_t* rhs = vrhs;
+
+    if (lhs->weight != rhs->weight)
+        return (lhs->weight < rhs->weight) - (lhs->weight > rhs->weight);
+    return (lhs->key > rhs->key) - (lhs->key < rhs->key);
+}
+
+// sorts the non-zero counts by decreasing weight, returns how many should be printed
+static int rank(const uint64_t* counts, int count, int top, ranked_t** out)
+{
+    ranked_t* ranked = malloc((count + 1) * sizeof(ranked_t));
+    int size = 0;
+    for (int i = 0; i < count; ++i)
+        if (counts[i])
+            ranked[size++] = (ranked_t){counts[i], i};
+    qsort(ranked, size, sizeof(ranked_t), ranked_cmp);
+
+    *out = ranked;
+    return (top && size > top) ? top : size;
+}
+
+static void print_sequence(FILE* out, uint64_t key, int n, const char* separator, const char* quote)
+{
+    int dense[3];
+    for (int i = n - 1; i >= 0; --i)
+    {
+        dense[i] = key % dense_count;
+        key /= dense_count;
+    }
+    for (int i = 0; i < n; ++i)
+        fprintf(out, "%s%s%s%s", i ? separator : "", quote, opcode_infos[op_of_dense[dense[i]]].name, quote);
+}
+
+// JSON has no literal for inf and nan, they're written as strings there
+static void print_operand_value(FILE* out, uint64_t key, int json)
+{
+    opcode_t op = key >> 32;
+    uint32_t bits = (uint32_t)key;
+    switch (opcode_infos[op].kind)
+    {
+        case OPERAND_1OP_F_IMM:
+        {
+            float val;
+            memcpy(&val, &bits, sizeof(float));
+            if (json && !isfinite(val))
+                fprintf(out, "\"%s\"", isnan(val) ? "nan" : val < 0 ? "-inf" : "inf");
+            else
+                fprintf(out, "%.9g", val);
+            break;
+        }
+        case OPERAND_1OP_VAR:
+        case OPERAND_1OP_TBL:
+            fprintf(out, "%u", bits & 0xFFFF);
+            break;
+        default:
+            fprintf(out, "%d", (int32_t)bits);
+            break;
+    }
+}
+
+static void write_report(FILE* out, const stats_t* stats, const stats_options_t* options, int weighted)
+{
+    const uint64_t* tables[3] = {stats->unigrams, stats->bigrams, stats->trigrams};
+    const int sizes[3] = {dense_count, dense_count*dense_count, dense_count*dense_count*dense_count};
+    const char* names[3] = {"opcodes", "bigrams", "trigrams"};
+    int json = options->format == STATS_JSON;
+
+    // operands are ranked from the open addressing table
+    ranked_t* operands = malloc((stats->operand_count + 1) * sizeof(ranked_t));
+    int operand_count = 0;
+    for (size_t i = 0; i < stats->operand_capacity; ++i)
+        if (stats->operands[i].key)
+            operands[operand_count++] = (ranked_t){stats->operands[i].weight, stats->operands[i].key};
+    qsort(operands, operand_count, sizeof(ranked_t), ranked_cmp);
+    int operand_shown = (options->top && operand_count > options->top) ? options->top : operand_count;
+
+    if (json)
+        fprintf(out, "{\n  \"files\": %llu,\n  \"instructions\": %llu,\n  \"weighting\": \"%s\",\n",
+                (unsigned long long)stats->files, (unsigned long long)stats->instructions, weighted ? "profile" : "static");
+    else
+        fprintf(out, "kind,sequence,value,weight,dispatches_saved\n");
+
+    for (int n = 0; n < 3; ++n)
+    {
+        ranked_t* ranked;
+        int shown = rank(tables[n], sizes[n], options->top, &ranked);
+
+        if (json)
+            fprintf(out, "  \"%s\": [\n", names[n]);
+        for (int i = 0; i < shown; ++i)
+        {
+            // fusing an n-gram saves n-1 dispatches per occurrence
+            unsigned long long weight = ranked[i].weight;
+            if (json)
+            {
+                fprintf(out, "    {\"seq\": [");
+                print_sequence(out, ranked[i].key, n + 1, ", ", "\"");
+                fprintf(out, "], \"weight\": %llu, \"dispatches_saved\": %llu}%s\n", weight, weight * n,
+                        i + 1 < shown ? "," : "");
+            }
+            else
+            {
+                fprintf(out, "%s,", names[n]);
+                print_sequence(out, ranked[i].key, n + 1, " ", "");
+                fprintf(out, ",,%llu,%llu\n", weight, weight * n);
+            }
+        }
+        if (json)
+            fprintf(out, "  ],\n");
+
+        free(ranked);
+    }
+
+    if (json)
+        fprintf(out, "  \"operands\": [\n");
+    for (int i = 0; i < operand_shown; ++i)
+    {
+        opcode_t op = operands[i].key >> 32;
+        if (json)
+        {
+            fprintf(out, "    {\"op\": \"%s\", \"value\": ", opcode_infos[op].name);
+            print_operand_value(out, operands[i].key, 1);
+            fprintf(out, ", \"weight\": %llu}%s\n", (unsigned long long)operands[i].weight, i + 1 < operand_shown ? "," : "");
+        }
+        else
+        {
+            fprintf(out, "operands,%s,", opcode_infos[op].name);
+            print_operand_value(out, operands[i].key, 0);
+            fprintf(out, ",%llu,\n", (unsigned long long)operands[i].weight);
+        }
+    }
+    if (json)
+        fprintf(out, "  ]\n}\n");
+
+    free(operands);
+}
+
+int run_corpus_stats(const stats_options_t* options)
+{
+    dense_count = 0;
+    for (int op = 0; op < 256; ++op)
+    {
+        dense_of[op] = -1;
+        if (opcode_infos[op].name)
+        {
+            dense_of[op] = dense_count;
+            op_of_dense[dense_count++] = op;
+        }
+    }
+
+    DYNARRAY_INIT(corpus_files, 256);
+    corpus_root_len = strlen(options->directory);
+    if (nftw(options->directory, collect_file, 32, FTW_PHYS) != 0)
+    {
+        fprintf(stderr, "could not walk '%s'\n", options->directory);
+        return -1;
+    }
+
+    stats_job_t* job = malloc(sizeof(stats_job_t));
+    job->options = options;
+    job->next_file = 0;
+    job->has_profile = options->profile != NULL;
+    if (job->has_profile && load_profile(job, options->profile) != 0)
+    {
+        free(job);
+        return -1;
+    }
+
+    int threads = options->threads;
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_STATS_THREADS)
+        threads = MAX_STATS_THREADS;
+    if (threads > corpus_files.size)
+        threads = corpus_files.size;
+    if (threads < 1)
+        threads = 1;
+
+    pthread_t thread_ids[MAX_STATS_THREADS];
+    worker_arg_t args[MAX_STATS_THREADS];
+    for (int i = 0; i < threads; ++i)
+    {
+        init_stats(&job->stats[i]);
+        args[i] = (worker_arg_t){job, i};
+        pthread_create(&thread_ids[i], NULL, stats_worker, &args[i]);
+    }
+    for (int i = 0; i < threads; ++i)
+        pthread_join(thread_ids[i], NULL);
+    for (int i = 1; i < threads; ++i)
+    {
+        merge_stats(&job->stats[0], &job->stats[i]);
+        free_stats(&job->stats[i]);
+    }
+
+    FILE* out = options->output ? fopen(options->output, "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "could not open output file '%s'\n", options->output);
+        return -1;
+    }
+    write_report(out, &job->stats[0], options, job->has_profile);
+    if (out != stdout)
+        fclose(out);
+
+    fprintf(stderr, "%llu files, %llu instructions", (unsigned long long)job->stats[0].files,
+            (unsigned long long)job->stats[0].instructions);
+    if (job->stats[0].failures)
+        fprintf(stderr, ", %llu unreadable or malformed", (unsigned long long)job->stats[0].failures);
+    fprintf(stderr, "\n");
+
+    free_stats(&job->stats[0]);
+    if (job->has_profile)
+    {
+        hash_table_iterate(&job->profiles, free_profile);
+        hash_table_clear(&job->profiles);
+    }
+    free(job);
+    for (int i = 0; i < corpus_files.size; ++i)
+        free(corpus_files.ptr[i]);
+    free(corpus_files.ptr);
+
+    return 0;
+}
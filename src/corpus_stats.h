@@ -0,0 +1,27 @@
+#ifndef CORPUS_STATS_H_INCLUDED
+#define CORPUS_STATS_H_INCLUDED
+
+// Opcode n-gram statistics over a directory of .dpa files, to find out which superinstructions
+// would remove the most dispatches.
+// N-grams don't cross basic block boundaries, since a fused instruction can't be entered in the middle.
+
+typedef enum stats_format_t
+{
+    STATS_CSV,
+    STATS_JSON
+} stats_format_t;
+
+typedef struct stats_options_t
+{
+    const char* directory;
+    // optional execution profile, CSV lines 'path,code offset,count' ; without it every instruction weighs 1
+    const char* profile;
+    const char* output; // NULL for stdout
+    stats_format_t format;
+    int threads;        // 0 for one per CPU
+    int top;            // entries per table, 0 for all of them
+} stats_options_t;
+
+int run_corpus_stats(const stats_options_t* options);
+
+#endif // CORPUS_STATS_H_INCLUDED
@@ -0,0 +1,477 @@
+#include "delta.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "hash_table.h"
+#include "image.h"
+#include "opcodes.h"
+#include "parser.h"
+
+typedef struct loaded_string_t
+{
+    const char* str;
+    uint16_t len;
+} loaded_string_t;
+
+typedef struct loaded_image_t
+{
+    uint8_t* data;
+    uint32_t init_addr;
+    DYNARRAY(loaded_string_t) strings;
+    const uint8_t* code;
+    uint32_t code_size;
+} loaded_image_t;
+
+typedef struct function_t
+{
+    const char* name;
+    uint32_t start, end; // in the new unit
+    int old_index;       // in the old symbol map, -1 for a new function
+    int kept;            // same encoding at the same address as in the old image
+    uint32_t addr;       // in the patched image
+} function_t;
+
+typedef struct relinker_t
+{
+    asm_unit_t* unit;
+    const symbol_map_t* old_map;
+    DYNARRAY(function_t) functions;
+    int* reloc_order; // relocation indices sorted by position
+    int* targets;     // target address of each relocation in the new unit
+} relinker_t;
+
+static int symbol_cmp(const void* vlhs, const void* vrhs)
+{
+    const symbol_t* lhs = vlhs;
+    const symbol_t* rhs = vrhs;
+
+    if (lhs->addr != rhs->addr)
+        return (lhs->addr > rhs->addr) - (lhs->addr < rhs->addr);
+    return strcmp(lhs->name, rhs->name);
+}
+
+void collect_functions(asm_unit_t* unit, symbol_map_t* map)
+{
+    DYNARRAY_INIT(map->symbols, 64);
+    for (size_t i = 0; i < unit->labels.bucket_count; ++i)
+        for (hash_node_t* node = unit->labels.buckets[i]; node; node = node->next_node)
+            if (node->key[0] != '.')
+                DYNARRAY_ADD(map->symbols, (symbol_t){strdup(node->key), node->value.idx, 0});
+
+    qsort(map->symbols.ptr, map->symbols.size, sizeof(symbol_t), symbol_cmp);
+    if (unit->object_buffer.size && (map->symbols.size == 0 || map->symbols.ptr[0].addr != 0))
+    {
+        DYNARRAY_ADD(map->symbols, (symbol_t){strdup(".start"), 0, 0});
+        qsort(map->symbols.ptr, map->symbols.size, sizeof(symbol_t), symbol_cmp);
+    }
+
+    // aliases share the size of the code up to the next address
+    uint32_t end = unit->object_buffer.size;
+    for (int i = map->symbols.size - 1; i >= 0; --i)
+    {
+        if (i + 1 < map->symbols.size && map->symbols.ptr[i + 1].addr != map->symbols.ptr[i].addr)
+            end = map->symbols.ptr[i + 1].addr;
+        map->symbols.ptr[i].size = end - map->symbols.ptr[i].addr;
+    }
+}
+
+int read_symbol_map(const char* path, symbol_map_t* map)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "could not open symbol map '%s'\n", path);
+        return -1;
+    }
+
+    DYNARRAY_INIT(map->symbols, 64);
+    char line[1024];
+    char name[1024];
+    unsigned addr, size;
+    while (fgets(line, sizeof(line), file))
+        if (sscanf(line, "%x %x %1023s", &addr, &size, name) == 3)
+            DYNARRAY_ADD(map->symbols, (symbol_t){strdup(name), addr, size});
+    fclose(file);
+
+    qsort(map->symbols.ptr, map->symbols.size, sizeof(symbol_t), symbol_cmp);
+    return 0;
+}
+
+void write_symbol_map(FILE* file, const symbol_map_t* map)
+{
+    for (int i = 0; i < map->symbols.size; ++i)
+        fprintf(file, "%08x %08x %s\n", map->symbols.ptr[i].addr, map->symbols.ptr[i].size, map->symbols.ptr[i].name);
+}
+
+void free_symbol_map(symbol_map_t* map)
+{
+    for (int i = 0; i < map->symbols.size; ++i)
+        free(map->symbols.ptr[i].name);
+    free(map->symbols.ptr);
+}
+
+static int load_image(const char* path, loaded_image_t* image)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "could not open image '%s'\n", path);
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    image->data = malloc(size > 0 ? size : 1);
+    size_t rd = fread(image->data, 1, size, file);
+    fclose(file);
+
+    const uint8_t* ptr = image->data;
+    const uint8_t* end = image->data + rd;
+    int extended = rd >= 10 && memcmp(ptr, "DNPE", 4) == 0;
+    if (rd < 10 || (!extended && memcmp(ptr, "DNPX", 4) != 0))
+    {
+        fprintf(stderr, "'%s' is not a DNPX image\n", path);
+        free(image->data);
+        return -1;
+    }
+
+    uint16_t string_count;
+    memcpy(&image->init_addr, ptr + 4, 4);
+    memcpy(&string_count, ptr + 8, 2);
+    ptr += 10;
+
+    DYNARRAY_INIT(image->strings, string_count + 1);
+    for (int i = 0; i < string_count && ptr + 2 <= end; ++i)
+    {
+        loaded_string_t str;
+        memcpy(&str.len, ptr, 2);
+        str.str = (const char*)ptr + 2;
+        ptr += 2 + str.len;
+        DYNARRAY_ADD(image->strings, str);
+    }
+
+    if (extended && ptr + 2 <= end)
+    {
+        uint16_t section_count;
+        memcpy(&section_count, ptr, 2);
+        ptr += 2;
+        for (int i = 0; i < section_count && ptr + 8 <= end; ++i)
+        {
+            uint32_t section_size;
+            memcpy(&section_size, ptr + 4, 4);
+            ptr += 8 + section_size;
+        }
+    }
+
+    if (ptr > end || image->strings.size != string_count)
+    {
+        fprintf(stderr, "'%s' is truncated\n", path);
+        free(image->strings.ptr);
+        free(image->data);
+        return -1;
+    }
+
+    image->code = ptr;
+    image->code_size = end - ptr;
+    return 0;
+}
+
+static int function_start_cmp(const void* vkey, const void* vfunction)
+{
+    uint32_t addr = *(const uint32_t*)vkey;
+    const function_t* function = vfunction;
+
+    if (addr < function->start)
+        return -1;
+    return addr >= function->end && function->end != function->start;
+}
+
+// address in the patched image of the new address 'addr', seen from code that is kept or appended
+static uint32_t relink_address(relinker_t* rl, uint32_t addr, int from_kept)
+{
+    // a label at the very end of the code belongs to the last function
+    uint32_t key = addr == (uint32_t)rl->unit->object_buffer.size && addr ? addr - 1 : addr;
+    function_t* function = bsearch(&key, rl->functions.ptr, rl->functions.size, sizeof(function_t), function_start_cmp);
+    if (!function)
+        return addr;
+
+    // unchanged code keeps calling old entries, the redirect table forwards them
+    if (from_kept && addr == function->start && function->old_index >= 0)
+        return rl->old_map->symbols.ptr[function->old_index].addr;
+    return function->addr + (addr - function->start);
+}
+
+// encoding of 'function' at its patched address
+static void encode_function(relinker_t* rl, const function_t* function, uint8_t* out)
+{
+    asm_unit_t* unit = rl->unit;
+    memcpy(out, unit->object_buffer.ptr + function->start, function->end - function->start);
+
+    // first relocation inside the function
+    int lo = 0, hi = unit->relocs.size;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (unit->relocs.ptr[rl->reloc_order[mid]].reloc_index < function->start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (int i = lo; i < unit->relocs.size; ++i)
+    {
+        int reloc = rl->reloc_order[i];
+        size_t index = unit->relocs.ptr[reloc].reloc_index;
+        if (index >= function->end)
+            break;
+
+        uint32_t target = relink_address(rl, rl->targets[reloc], function->kept);
+        memcpy(out + (index - function->start), &target, sizeof(target));
+    }
+}
+
+static relinker_t* sort_relocs_rl; // qsort has no user pointer
+
+static int reloc_order_cmp(const void* vlhs, const void* vrhs)
+{
+    size_t lhs = sort_relocs_rl->unit->relocs.ptr[*(const int*)vlhs].reloc_index;
+    size_t rhs = sort_relocs_rl->unit->relocs.ptr[*(const int*)vrhs].reloc_index;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static void put_u32(FILE* file, uint32_t val)
+{
+    fwrite(&val, sizeof(uint32_t), 1, file);
+}
+
+int write_delta(FILE* patch, asm_unit_t* unit, const delta_options_t* options)
+{
+    if (unit->pic || unit->sections.size || unit->tables.size)
+    {
+        fprintf(stderr, "hot reload patches of position-independent code or of units with sections or jump tables "
+                        "aren't supported\n");
+        return -1;
+    }
+
+    loaded_image_t old;
+    symbol_map_t old_map;
+    if (load_image(options->base_image, &old) != 0)
+        return -1;
+    if (read_symbol_map(options->base_map, &old_map) != 0)
+    {
+        free(old.strings.ptr);
+        free(old.data);
+        return -1;
+    }
+
+    hash_table_t old_names = mk_hash_table(257);
+    for (int i = 0; i < old_map.symbols.size; ++i)
+        hash_table_insert(&old_names, old_map.symbols.ptr[i].name, (hash_value_t){.idx = i});
+
+    // one function per address range, named after its first alias
+    symbol_map_t new_map;
+    collect_functions(unit, &new_map);
+    hash_table_t new_names = mk_hash_table(257);
+
+    relinker_t rl;
+    rl.unit = unit;
+    rl.old_map = &old_map;
+    DYNARRAY_INIT(rl.functions, new_map.symbols.size + 1);
+    for (int i = 0; i < new_map.symbols.size; ++i)
+    {
+        const symbol_t* symbol = &new_map.symbols.ptr[i];
+        hash_table_insert(&new_names, symbol->name, (hash_value_t){.idx = i});
+        if (rl.functions.size && rl.functions.ptr[rl.functions.size - 1].start == symbol->addr)
+            continue;
+
+        hash_value_t* old_index = hash_table_get(&old_names, symbol->name);
+        function_t function = {symbol->name, symbol->addr, symbol->addr + symbol->size, old_index ? old_index->idx : -1, 0, 0};
+        function.kept = old_index && old_map.symbols.ptr[old_index->idx].size == symbol->size
+                                  && old_map.symbols.ptr[old_index->idx].addr + symbol->size <= old.code_size;
+        DYNARRAY_ADD(rl.functions, function);
+    }
+
+    rl.reloc_order = malloc((unit->relocs.size + 1) * sizeof(int));
+    rl.targets = malloc((unit->relocs.size + 1) * sizeof(int));
+    for (int i = 0; i < unit->relocs.size; ++i)
+    {
+        rl.reloc_order[i] = i;
+        rl.targets[i] = reloc_target_address(unit, &unit->relocs.ptr[i]);
+    }
+    sort_relocs_rl = &rl;
+    qsort(rl.reloc_order, unit->relocs.size, sizeof(int), reloc_order_cmp);
+
+    // moving a function changes the address of its labels, which can change the encoding of a kept one
+    uint8_t* scratch = malloc(unit->object_buffer.size + 1);
+    uint32_t appended_size;
+    int changed;
+    do
+    {
+        appended_size = 0;
+        for (int i = 0; i < rl.functions.size; ++i)
+        {
+            function_t* function = &rl.functions.ptr[i];
+            if (function->kept)
+                function->addr = old_map.symbols.ptr[function->old_index].addr;
+            else
+            {
+                function->addr = old.code_size + appended_size;
+                appended_size += function->end - function->start;
+            }
+        }
+
+        changed = 0;
+        for (int i = 0; i < rl.functions.size; ++i)
+        {
+            function_t* function = &rl.functions.ptr[i];
+            if (!function->kept)
+                continue;
+
+            encode_function(&rl, function, scratch);
+            if (memcmp(scratch, old.code + function->addr, function->end - function->start) != 0)
+            {
+                function->kept = 0;
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    uint8_t* appended = malloc(appended_size + 1);
+    for (int i = 0; i < rl.functions.size; ++i)
+        if (!rl.functions.ptr[i].kept)
+            encode_function(&rl, &rl.functions.ptr[i], appended + (rl.functions.ptr[i].addr - old.code_size));
+
+    hash_value_t* init = hash_table_get(&unit->labels, "_global_init");
+    uint32_t init_addr = init ? relink_address(&rl, init->idx, 0) : 0;
+    if (!init)
+        printf("warning : no '_global_init' symbol !\n");
+
+    fwrite("DNPD", 1, 4, patch);
+    uint64_t old_hash = mem_hash(old.code, old.code_size);
+    fwrite(&old_hash, sizeof(uint64_t), 1, patch);
+    put_u32(patch, old.code_size);
+    put_u32(patch, init_addr);
+    put_u32(patch, appended_size);
+    fwrite(appended, 1, appended_size, patch);
+
+    int redirects = 0, removed = 0;
+    for (int i = 0; i < rl.functions.size; ++i)
+        redirects += !rl.functions.ptr[i].kept && rl.functions.ptr[i].old_index >= 0;
+    put_u32(patch, redirects);
+    for (int i = 0; i < rl.functions.size; ++i)
+        if (!rl.functions.ptr[i].kept && rl.functions.ptr[i].old_index >= 0)
+        {
+            put_u32(patch, old_map.symbols.ptr[rl.functions.ptr[i].old_index].addr);
+            put_u32(patch, rl.functions.ptr[i].addr);
+        }
+
+    // old functions none of whose names survive
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        if (pass == 1)
+            put_u32(patch, removed);
+        for (int i = 0; i < old_map.symbols.size; ++i)
+        {
+            const symbol_t* symbol = &old_map.symbols.ptr[i];
+            if (i > 0 && old_map.symbols.ptr[i - 1].addr == symbol->addr)
+                continue;
+
+            int alive = 0;
+            for (int j = i; j < old_map.symbols.size && old_map.symbols.ptr[j].addr == symbol->addr; ++j)
+                alive |= hash_table_get(&new_names, old_map.symbols.ptr[j].name) != NULL;
+            if (alive)
+                continue;
+
+            if (pass == 0)
+                ++removed;
+            else
+            {
+                put_u32(patch, symbol->addr);
+                put_u32(patch, symbol->size);
+            }
+        }
+    }
+
+    int changed_strings = 0;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        if (pass == 1)
+        {
+            put_u32(patch, unit->strings.size);
+            put_u32(patch, changed_strings);
+        }
+        for (int i = 0; i < unit->strings.size; ++i)
+        {
+            const string_constant_t* str = &unit->strings.ptr[i];
+            if (i < old.strings.size && old.strings.ptr[i].len == str->len && memcmp(old.strings.ptr[i].str, str->str, str->len) == 0)
+                continue;
+
+            if (pass == 0)
+                ++changed_strings;
+            else
+            {
+                put_u32(patch, i);
+                image_write_string(patch, str->str, str->len);
+            }
+        }
+    }
+
+    if (options->patched_image)
+    {
+        FILE* file = fopen(options->patched_image, "wb");
+        if (file)
+        {
+            image_write_header(file, init_addr, unit->strings.size, 0);
+            for (int i = 0; i < unit->strings.size; ++i)
+                image_write_string(file, unit->strings.ptr[i].str, unit->strings.ptr[i].len);
+            fwrite(old.code, 1, old.code_size, file);
+            fwrite(appended, 1, appended_size, file);
+            fclose(file);
+        }
+        else
+            fprintf(stderr, "could not open output file '%s'\n", options->patched_image);
+    }
+
+    if (options->symbols)
+    {
+        FILE* file = fopen(options->symbols, "w");
+        if (file)
+        {
+            // every alias takes the address of its function
+            for (int i = 0, f = 0; i < new_map.symbols.size; ++i)
+            {
+                while (rl.functions.ptr[f].start != new_map.symbols.ptr[i].addr)
+                    ++f;
+                new_map.symbols.ptr[i].addr = rl.functions.ptr[f].addr;
+            }
+            qsort(new_map.symbols.ptr, new_map.symbols.size, sizeof(symbol_t), symbol_cmp);
+            write_symbol_map(file, &new_map);
+            fclose(file);
+        }
+        else
+            fprintf(stderr, "could not open output file '%s'\n", options->symbols);
+    }
+
+    int appended_count = 0;
+    for (int i = 0; i < rl.functions.size; ++i)
+        appended_count += !rl.functions.ptr[i].kept;
+    fprintf(stderr, "patch : %d of %d functions appended (%u bytes), %d redirected, %d removed, %d strings changed\n",
+            appended_count, rl.functions.size, appended_size, redirects, removed, changed_strings);
+
+    free(appended);
+    free(scratch);
+    free(rl.reloc_order);
+    free(rl.targets);
+    free(rl.functions.ptr);
+    hash_table_clear(&new_names);
+    hash_table_clear(&old_names);
+    free_symbol_map(&new_map);
+    free_symbol_map(&old_map);
+    free(old.strings.ptr);
+    free(old.data);
+
+    return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef DELTA_H_INCLUDED
+#define DELTA_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "asm_unit_info.h"
+#include "dynarray.h"
+
+/*
+ Hot reload patches.
+ A symbol map lists the functions (global labels) of an image, one per line : "<hex address> <hex size> <name>".
+ Code before the first global label is the function ".start".
+
+ Given the image a VM is running and its symbol map, write_delta relinks the new unit so that every function
+ whose encoding didn't change keeps its old address, appends the changed and new functions after the old code,
+ and writes a "DNPD" patch :
+   "DNPD"
+   uint64_t mem_hash of the old code, uint32_t old code size
+   uint32_t _global_init address
+   uint32_t appended code size, code
+   uint32_t redirect count, then (uint32_t old address, uint32_t new address) for each moved function
+   uint32_t removed count, then (uint32_t address, uint32_t size) for each function that is gone
+   uint32_t new string count, uint32_t changed string count, then (uint32_t index, uint16_t length, data)
+ Unchanged code keeps calling the old entry of a moved function, which the VM redirects ; appended code
+ calls the new addresses directly. Sections (e.g. "FRAM") and position-independent units aren't supported.
+*/
+
+typedef struct symbol_t
+{
+    char*    name;
+    uint32_t addr;
+    uint32_t size;
+} symbol_t;
+
+typedef struct symbol_map_t
+{
+    DYNARRAY(symbol_t) symbols; // sorted by address
+} symbol_map_t;
+
+// functions of a unit whose labels are all placed, relocations don't need to be resolved
+void collect_functions(asm_unit_t* unit, symbol_map_t* map);
+int  read_symbol_map(const char* path, symbol_map_t* map);
+void write_symbol_map(FILE* file, const symbol_map_t* map);
+void free_symbol_map(symbol_map_t* map);
+
+typedef struct delta_options_t
+{
+    const char* base_image; // image the VM is running
+    const char* base_map;   // its symbol map
+    const char* patched_image; // optional, the image the VM ends up with, to base the next patch on
+    const char* symbols;       // optional, symbol map of the patched image
+} delta_options_t;
+
+// 'unit' must have its strings sorted and its relocations unresolved, returns 0 on success
+int write_delta(FILE* patch, asm_unit_t* unit, const delta_options_t* options);
+
+#endif // DELTA_H_INCLUDED
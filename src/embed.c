@@ -0,0 +1,270 @@
+#define _GNU_SOURCE
+
+#include "embed.h"
+
+#include <ctype.h>
+#include <elf.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "delta.h"
+#include "dynarray.h"
+#include "image.h"
+
+#if defined(__x86_64__)
+#define EMBED_ELF_MACHINE EM_X86_64
+#elif defined(__aarch64__)
+#define EMBED_ELF_MACHINE EM_AARCH64
+#elif defined(__riscv) && __riscv_xlen == 64
+#define EMBED_ELF_MACHINE EM_RISCV
+#elif defined(__powerpc64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define EMBED_ELF_MACHINE EM_PPC64
+#endif
+
+char* default_symbol_name(const char* path)
+{
+    const char* base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    const char* dot = strrchr(base, '.');
+    size_t len = (dot && dot != base) ? (size_t)(dot - base) : strlen(base);
+
+    // room for a leading '_' and the terminator
+    char* name = malloc(len + 2);
+    char* out = name;
+    if (len == 0 || isdigit((unsigned char)base[0]))
+        *out++ = '_';
+    for (size_t i = 0; i < len; ++i)
+        *out++ = (isalnum((unsigned char)base[i]) || base[i] == '_') ? base[i] : '_';
+    *out = '\0';
+
+    return name;
+}
+
+static char* sanitized(const char* name)
+{
+    char* copy = strdup(name);
+    for (char* c = copy; *c; ++c)
+        if (!isalnum((unsigned char)*c) && *c != '_')
+            *c = '_';
+    return copy;
+}
+
+#ifdef EMBED_ELF_MACHINE
+
+typedef struct elf_writer_t
+{
+    DYNARRAY(char) strtab;
+    DYNARRAY(Elf64_Sym) symbols;
+} elf_writer_t;
+
+static Elf64_Word add_string(elf_writer_t* writer, const char* str)
+{
+    Elf64_Word offset = writer->strtab.size;
+    size_t len = strlen(str) + 1;
+    for (size_t i = 0; i < len; ++i)
+        DYNARRAY_ADD(writer->strtab, str[i]);
+    return offset;
+}
+
+static void add_symbol(elf_writer_t* writer, const char* name, unsigned char info, Elf64_Section section,
+                       Elf64_Addr value, Elf64_Xword size)
+{
+    Elf64_Sym sym;
+    memset(&sym, 0, sizeof(sym));
+    sym.st_name = name ? add_string(writer, name) : 0;
+    sym.st_info = info;
+    sym.st_other = STV_DEFAULT;
+    sym.st_shndx = section;
+    sym.st_value = value;
+    sym.st_size = size;
+    DYNARRAY_ADD(writer->symbols, sym);
+}
+
+static long align_up(long offset, long alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+static void pad_to(FILE* file, long* offset, long alignment)
+{
+    while (*offset % alignment)
+    {
+        fputc(0, file);
+        ++*offset;
+    }
+}
+
+enum
+{
+    SECTION_NULL,
+    SECTION_RODATA,
+    SECTION_SYMTAB,
+    SECTION_STRTAB,
+    SECTION_NOTE_STACK,
+    SECTION_SHSTRTAB,
+    SECTION_COUNT
+};
+
+int write_elf_object(FILE* file, const uint8_t* image, size_t size, asm_unit_t* unit, const char* symbol)
+{
+    elf_writer_t writer;
+    DYNARRAY_INIT(writer.strtab, 256);
+    DYNARRAY_INIT(writer.symbols, 16);
+    add_string(&writer, "");
+
+    symbol_map_t map;
+    collect_functions(unit, &map);
+
+    // .rodata : image, padding, uint64_t size, uint32_t address of each label
+    Elf64_Xword size_offset = (size + 7) & ~(Elf64_Xword)7;
+    Elf64_Xword labels_offset = size_offset + sizeof(uint64_t);
+    Elf64_Xword rodata_size = labels_offset + map.symbols.size * sizeof(uint32_t);
+
+    char name[1024];
+    add_symbol(&writer, NULL, ELF64_ST_INFO(STB_LOCAL, STT_NOTYPE), SHN_UNDEF, 0, 0);
+    add_symbol(&writer, NULL, ELF64_ST_INFO(STB_LOCAL, STT_SECTION), SECTION_RODATA, 0, 0);
+    Elf64_Word first_global = writer.symbols.size;
+
+    snprintf(name, sizeof(name), "%s_start", symbol);
+    add_symbol(&writer, name, ELF64_ST_INFO(STB_GLOBAL, STT_OBJECT), SECTION_RODATA, 0, size);
+    snprintf(name, sizeof(name), "%s_end", symbol);
+    add_symbol(&writer, name, ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE), SECTION_RODATA, size, 0);
+    snprintf(name, sizeof(name), "%s_size", symbol);
+    add_symbol(&writer, name, ELF64_ST_INFO(STB_GLOBAL, STT_OBJECT), SECTION_RODATA, size_offset, sizeof(uint64_t));
+    for (int i = 0; i < map.symbols.size; ++i)
+    {
+        char* label = sanitized(map.symbols.ptr[i].name);
+        snprintf(name, sizeof(name), "%s_label_%s", symbol, label);
+        add_symbol(&writer, name, ELF64_ST_INFO(STB_GLOBAL, STT_OBJECT), SECTION_RODATA,
+                   labels_offset + i * sizeof(uint32_t), sizeof(uint32_t));
+        free(label);
+    }
+
+    static const char shstrtab[] = "\0.rodata\0.symtab\0.strtab\0.note.GNU-stack\0.shstrtab";
+    const Elf64_Word shstr_names[SECTION_COUNT] = {0, 1, 9, 17, 25, 41};
+
+    // layout : header, .rodata, .symtab, .strtab, .shstrtab, section headers
+    // everything is placed before writing, so that the output doesn't need to be seekable
+    size_t symtab_size = writer.symbols.size * sizeof(Elf64_Sym);
+    long rodata_offset = align_up(sizeof(Elf64_Ehdr), 16);
+    long symtab_offset = align_up(rodata_offset + rodata_size, 8);
+    long strtab_offset = symtab_offset + symtab_size;
+    long shstrtab_offset = strtab_offset + writer.strtab.size;
+    long sections_offset = align_up(shstrtab_offset + sizeof(shstrtab), 8);
+
+    Elf64_Shdr sections[SECTION_COUNT];
+    memset(sections, 0, sizeof(sections));
+    sections[SECTION_RODATA] = (Elf64_Shdr){shstr_names[SECTION_RODATA], SHT_PROGBITS, SHF_ALLOC, 0, rodata_offset, rodata_size, 0, 0, 16, 0};
+    sections[SECTION_SYMTAB] = (Elf64_Shdr){shstr_names[SECTION_SYMTAB], SHT_SYMTAB, 0, 0, symtab_offset, symtab_size,
+                                            SECTION_STRTAB, first_global, 8, sizeof(Elf64_Sym)};
+    sections[SECTION_STRTAB] = (Elf64_Shdr){shstr_names[SECTION_STRTAB], SHT_STRTAB, 0, 0, strtab_offset, writer.strtab.size, 0, 0, 1, 0};
+    // an empty .note.GNU-stack keeps the linker from making the stack executable
+    sections[SECTION_NOTE_STACK] = (Elf64_Shdr){shstr_names[SECTION_NOTE_STACK], SHT_PROGBITS, 0, 0, shstrtab_offset, 0, 0, 0, 1, 0};
+    sections[SECTION_SHSTRTAB] = (Elf64_Shdr){shstr_names[SECTION_SHSTRTAB], SHT_STRTAB, 0, 0, shstrtab_offset, sizeof(shstrtab), 0, 0, 1, 0};
+
+    Elf64_Ehdr header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_NONE;
+    header.e_type = ET_REL;
+    header.e_machine = EMBED_ELF_MACHINE;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = sections_offset;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = SECTION_COUNT;
+    header.e_shstrndx = SECTION_SHSTRTAB;
+
+    long offset = 0;
+    fwrite(&header, sizeof(header), 1, file);
+    offset += sizeof(header);
+
+    pad_to(file, &offset, 16);
+    fwrite(image, 1, size, file);
+    offset += size;
+    pad_to(file, &offset, 8);
+    uint64_t size_value = size;
+    fwrite(&size_value, sizeof(size_value), 1, file);
+    for (int i = 0; i < map.symbols.size; ++i)
+        fwrite(&map.symbols.ptr[i].addr, sizeof(uint32_t), 1, file);
+    offset += rodata_size - size_offset;
+    free_symbol_map(&map);
+
+    pad_to(file, &offset, 8);
+    fwrite(writer.symbols.ptr, sizeof(Elf64_Sym), writer.symbols.size, file);
+    fwrite(writer.strtab.ptr, 1, writer.strtab.size, file);
+    fwrite(shstrtab, 1, sizeof(shstrtab), file);
+    offset += symtab_size + writer.strtab.size + sizeof(shstrtab);
+
+    pad_to(file, &offset, 8);
+    fwrite(sections, sizeof(Elf64_Shdr), SECTION_COUNT, file);
+
+    free(writer.strtab.ptr);
+    free(writer.symbols.ptr);
+
+    return ferror(file) ? -1 : 0;
+}
+
+#else
+
+int write_elf_object(FILE* file, const uint8_t* image, size_t size, asm_unit_t* unit, const char* symbol)
+{
+    (void)file; (void)image; (void)size; (void)unit; (void)symbol;
+    fprintf(stderr, "ELF output is only supported on 64-bit little-endian hosts\n");
+    return -1;
+}
+
+#endif // EMBED_ELF_MACHINE
+
+int write_c_array(FILE* file, const uint8_t* image, size_t size, asm_unit_t* unit, const char* symbol)
+{
+    fprintf(file, "/* DNPX image generated by DanPaAssembler */\n\n"
+                  "#include <stddef.h>\n"
+                  "#include <stdint.h>\n\n");
+
+    fprintf(file, "__attribute__((aligned(16))) const uint8_t %s_start[%zu] =\n{", symbol, size ? size : 1);
+    for (size_t i = 0; i < size; ++i)
+        fprintf(file, "%s0x%02x,", i % 16 ? " " : "\n    ", image[i]);
+    fprintf(file, "\n};\n"
+                  "const size_t %s_size = %zu;\n\n", symbol, size);
+
+    symbol_map_t map;
+    collect_functions(unit, &map);
+    if (map.symbols.size)
+        fprintf(file, "/* code addresses of the global labels */\n");
+    for (int i = 0; i < map.symbols.size; ++i)
+    {
+        char* label = sanitized(map.symbols.ptr[i].name);
+        fprintf(file, "const uint32_t %s_label_%s = 0x%08x;\n", symbol, label, map.symbols.ptr[i].addr);
+        free(label);
+    }
+    free_symbol_map(&map);
+
+    return ferror(file) ? -1 : 0;
+}
+
+int write_output(FILE* file, asm_unit_t* unit, const asm_options_t* options, const char* out_name)
+{
+    if (options->output_format == OUTPUT_DNPX)
+    {
+        write_image(file, unit);
+        return ferror(file) ? -1 : 0;
+    }
+
+    char* image;
+    size_t size;
+    FILE* memory = open_memstream(&image, &size);
+    write_image(memory, unit);
+    fclose(memory);
+
+    char* symbol = options->symbol_name ? strdup(options->symbol_name) : default_symbol_name(out_name);
+    int result = options->output_format == OUTPUT_ELF ? write_elf_object(file, (const uint8_t*)image, size, unit, symbol)
+                                                      : write_c_array(file, (const uint8_t*)image, size, unit, symbol);
+
+    free(symbol);
+    free(image);
+    return result;
+}
@@ -0,0 +1,32 @@
+#ifndef EMBED_H_INCLUDED
+#define EMBED_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "asm_unit_info.h"
+#include "options.h"
+
+/*
+ Output formats to link an image into the VM binary.
+ Both define, for a symbol name <sym> (--symbol-name, or the output file name without its extension) :
+   const uint8_t  <sym>_start[]        : the image, 16-byte aligned
+   const size_t   <sym>_size           : its size
+   const uint32_t <sym>_label_<label>  : code address of each global label
+ all in read-only data, so they can be used from position-independent executables.
+ OUTPUT_ELF writes an ELF64 relocatable object for the host machine, with everything in .rodata
+ and <sym>_end marking the end of the image.
+ OUTPUT_C writes a C source file with the same definitions.
+*/
+
+// symbol prefix derived from a path : file name without extension, other characters than [A-Za-z0-9_] replaced
+char* default_symbol_name(const char* path);
+
+int write_elf_object(FILE* file, const uint8_t* image, size_t size, asm_unit_t* unit, const char* symbol);
+int write_c_array(FILE* file, const uint8_t* image, size_t size, asm_unit_t* unit, const char* symbol);
+
+// writes the unit in the format selected by the options, returns 0 on success
+int write_output(FILE* file, asm_unit_t* unit, const asm_options_t* options, const char* out_name);
+
+#endif // EMBED_H_INCLUDED
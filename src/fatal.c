@@ -0,0 +1,12 @@
+#include "fatal.h"
+
+#include <stdlib.h>
+
+_Thread_local jmp_buf* asm_recovery_point = NULL;
+
+void asm_fatal(void)
+{
+    if (asm_recovery_point)
+        longjmp(*asm_recovery_point, 1);
+    abort();
+}
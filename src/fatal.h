@@ -0,0 +1,17 @@
+#ifndef FATAL_H_INCLUDED
+#define FATAL_H_INCLUDED
+
+#include <setjmp.h>
+
+/*
+ Errors in a unit are reported on stderr where they're found, then assembly stops with asm_fatal.
+ It aborts, unless the thread has set a recovery point : drivers assembling many units (--batch, --stats)
+ longjmp back to it, free the unit and go on with the next one. The memory of the failed step itself
+ (tokens, IR) isn't reclaimed.
+*/
+
+extern _Thread_local jmp_buf* asm_recovery_point;
+
+_Noreturn void asm_fatal(void);
+
+#endif // FATAL_H_INCLUDED
@@ -0,0 +1,391 @@
+#include "frame_analysis.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "image.h"
+
+typedef struct stack_effect_t
+{
+    int8_t pops, pushes;
+} stack_effect_t;
+
+// keep in sync with the VM ; call, calli, ret, syscall and stackcpy are handled separately
+static const stack_effect_t stack_effects[256] =
+{
+    [OP_chknotnul] = {1, 1}, [OP_isnull] = {1, 1},
+    [OP_strlen] = {1, 1}, [OP_strcat] = {2, 1}, [OP_stradd] = {2, 1}, [OP_streq] = {2, 1},
+    [OP_add] = {2, 1}, [OP_sub] = {2, 1}, [OP_mul] = {2, 1}, [OP_idiv] = {2, 1}, [OP_mod] = {2, 1},
+    [OP_inc] = {1, 1}, [OP_dec] = {1, 1}, [OP_shl] = {2, 1}, [OP_shr] = {2, 1},
+    [OP_cvtf2i] = {1, 1}, [OP_cvti2f] = {1, 1}, [OP_cvti2s] = {1, 1}, [OP_cvtf2s] = {1, 1},
+    [OP_eq] = {2, 1}, [OP_neq] = {2, 1}, [OP_lt] = {2, 1},
+    [OP_land] = {2, 1}, [OP_lor] = {2, 1}, [OP_lnot] = {1, 1}, [OP_feq] = {2, 1},
+    [OP_alloc] = {1, 1}, [OP_copy] = {1, 1}, [OP_load] = {2, 1}, [OP_store] = {3, 0},
+    [OP_memsize] = {1, 1}, [OP_memresize] = {2, 0}, [OP_arraycat] = {2, 1},
+    [OP_find] = {2, 1}, [OP_findi] = {2, 1}, [OP_mkrange] = {2, 1},
+    [OP_randi] = {2, 1}, [OP_randf] = {0, 1}, [OP_randa] = {1, 1},
+    [OP_pow] = {2, 1}, [OP_ln] = {1, 1}, [OP_log10] = {1, 1}, [OP_exp] = {1, 1}, [OP_sqrt] = {1, 1},
+    [OP_abs] = {1, 1}, [OP_fabs] = {1, 1}, [OP_ceil] = {1, 1}, [OP_floor] = {1, 1},
+    [OP_rad2deg] = {1, 1}, [OP_deg2rad] = {1, 1},
+    [OP_eql] = {1, 1}, [OP_neql] = {1, 1}, [OP_ltl] = {1, 1},
+    [OP_cos] = {1, 1}, [OP_sin] = {1, 1}, [OP_tan] = {1, 1},
+    [OP_acos] = {1, 1}, [OP_asin] = {1, 1}, [OP_atan] = {1, 1}, [OP_atan2] = {2, 1},
+    [OP_pop] = {1, 0}, [OP_pushi] = {0, 1}, [OP_pushf] = {0, 1}, [OP_pushs] = {0, 1},
+    [OP_pushl] = {0, 1}, [OP_pushg] = {0, 1}, [OP_movl] = {1, 0}, [OP_movg] = {1, 0},
+    [OP_copyl] = {1, 1}, [OP_dup] = {1, 2}, [OP_getaddrl] = {0, 1}, [OP_getaddrg] = {0, 1},
+    [OP_cmov] = {3, 1}, [OP_pushnull] = {0, 1}, [OP_pushib] = {0, 1}, [OP_pusha] = {0, 1},
+    [OP_pushk] = {0, 1}, [OP_pushkw] = {0, 1},
+    [OP_jt] = {1, 0}, [OP_jf] = {1, 0}, [OP_jmpt] = {1, 0}, [OP_loadt] = {1, 1},
+};
+
+// syscall #0 prints the top of the stack, #1 reads a value, #3 exits
+static int syscall_effect(int32_t number, stack_effect_t* effect)
+{
+    switch (number)
+    {
+        case 0:
+            *effect = (stack_effect_t){1, 0};
+            return 1;
+        case 1:
+            *effect = (stack_effect_t){0, 1};
+            return 1;
+        case 3:
+            *effect = (stack_effect_t){0, 0};
+            return 1;
+        default:
+            *effect = (stack_effect_t){0, 0};
+            return 0;
+    }
+}
+
+int instruction_stack_effect(const ir_ins_t* ins, int* pops, int* pushes)
+{
+    stack_effect_t effect = stack_effects[ins->op];
+    int known = 1;
+    switch (ins->op)
+    {
+        case OP_call:
+        case OP_calli:
+        case OP_stackcpy:
+            known = 0;
+            break;
+        case OP_syscall:
+            known = syscall_effect(ins->operand.i, &effect);
+            break;
+        default:
+            break;
+    }
+
+    *pops = effect.pops;
+    *pushes = effect.pushes;
+    return known;
+}
+
+typedef struct summary_t
+{
+    int known;
+    int args, net, max_stack, locals, flags;
+    int stalled; // a call to a function whose summary isn't known yet
+} summary_t;
+
+typedef struct analysis_t
+{
+    const ir_program_t* prog;
+    cfg_t cfg;
+    int* entry_of_block; // -1 if the block isn't a function entry
+    int* block_label;    // a label at the start of each block, -1 if none
+    DYNARRAY(int) entries;
+    summary_t* summaries;
+    int* depth_in;
+    int* worklist;
+    int* visited;
+} analysis_t;
+
+static const char* entry_name(const analysis_t* an, int block)
+{
+    int label = an->block_label[block];
+    if (label < 0 || an->prog->labels.ptr[label].name == NULL)
+        return "<anonymous>";
+    return an->prog->labels.ptr[label].name;
+}
+
+static summary_t analyze_entry(analysis_t* an, int entry_block, int report)
+{
+    const ir_program_t* prog = an->prog;
+    summary_t result = {1, 0, 0, 0, 0, 0, 0};
+    int min_depth = 0, max_depth = 0;
+    int ret_depth = INT_MIN;
+    int top = 0;
+    int visited = 0;
+
+    // depth_in is all INT_MIN between two calls, only the visited blocks are reset at the end
+    an->depth_in[entry_block] = 0;
+    an->visited[visited++] = entry_block;
+    an->worklist[top++] = entry_block;
+
+    while (top)
+    {
+        int block_idx = an->worklist[--top];
+        const basic_block_t* block = &an->cfg.blocks.ptr[block_idx];
+        int depth = an->depth_in[block_idx];
+        int stalled = 0;
+
+        for (int i = block->start; i < block->end && !stalled; ++i)
+        {
+            const ir_ins_t* ins = &prog->ins.ptr[i];
+            stack_effect_t effect = stack_effects[ins->op];
+
+            if (ir_uses_local(ins->op) && ins->operand.var + 1 > result.locals)
+                result.locals = ins->operand.var + 1;
+
+            switch (ins->op)
+            {
+                case OP_call:
+                {
+                    int callee_block = an->cfg.label_block[ins->target];
+                    const summary_t* callee = callee_block >= 0 ? &an->summaries[an->entry_of_block[callee_block]] : NULL;
+                    if (!callee || !callee->known)
+                    {
+                        stalled = 1;
+                        continue;
+                    }
+                    effect.pops = callee->args;
+                    effect.pushes = callee->args + callee->net;
+                    result.flags |= callee->flags & FRAME_IMPRECISE;
+                    break;
+                }
+                case OP_calli:
+                    effect = (stack_effect_t){1, 0};
+                    result.flags |= FRAME_IMPRECISE;
+                    break;
+                case OP_syscall:
+                    if (!syscall_effect(ins->operand.i, &effect))
+                        result.flags |= FRAME_IMPRECISE;
+                    break;
+                case OP_stackcpy:
+                    result.flags |= FRAME_IMPRECISE;
+                    break;
+                case OP_ret:
+                    if (ret_depth == INT_MIN)
+                        ret_depth = depth;
+                    else if (ret_depth != depth && !(result.flags & FRAME_UNBALANCED))
+                    {
+                        result.flags |= FRAME_UNBALANCED;
+                        if (report)
+                            fprintf(stderr, "warning : '%s' returns with different stack depths (%d and %d)\n",
+                                    entry_name(an, entry_block), ret_depth, depth);
+                    }
+                    break;
+                default:
+                    break;
+            }
+
+            depth -= effect.pops;
+            if (depth < min_depth)
+                min_depth = depth;
+            depth += effect.pushes;
+            if (depth > max_depth)
+                max_depth = depth;
+        }
+
+        if (stalled)
+        {
+            result.stalled = 1;
+            continue;
+        }
+
+        // a 'jmpt' continues at every entry of its table
+        const ir_ins_t* last = &prog->ins.ptr[block->end - 1];
+        const ir_table_t* table = last->op == OP_jmpt ? &prog->tables.ptr[last->operand.var] : NULL;
+        int successors[2] = {block->branch, block->fallthrough};
+        int successor_count = 2 + (table ? table->labels.size : 0);
+        for (int i = 0; i < successor_count; ++i)
+        {
+            int next = i < 2 ? successors[i] : an->cfg.label_block[table->labels.ptr[i - 2]];
+            if (next < 0)
+                continue;
+            if (an->depth_in[next] == INT_MIN)
+            {
+                an->depth_in[next] = depth;
+                an->visited[visited++] = next;
+                an->worklist[top++] = next;
+            }
+            else if (an->depth_in[next] != depth)
+            {
+                if (report && !(result.flags & FRAME_UNBALANCED))
+                {
+                    int label = an->block_label[next];
+                    fprintf(stderr, "warning : stack imbalance in '%s' at '%s' (depth %d and %d)\n",
+                            entry_name(an, entry_block),
+                            label >= 0 && prog->labels.ptr[label].name ? prog->labels.ptr[label].name : "?",
+                            an->depth_in[next], depth);
+                }
+                result.flags |= FRAME_UNBALANCED;
+            }
+        }
+    }
+
+    for (int i = 0; i < visited; ++i)
+        an->depth_in[an->visited[i]] = INT_MIN;
+
+    result.args = -min_depth;
+    result.max_stack = max_depth;
+    if (ret_depth == INT_MIN)
+    {
+        result.net = 0;
+        if (!result.stalled)
+            result.flags |= FRAME_NO_RETURN;
+        else
+            result.known = 0;
+    }
+    else
+        result.net = ret_depth;
+
+    return result;
+}
+
+static void add_entry(analysis_t* an, int block)
+{
+    if (block < 0 || an->entry_of_block[block] >= 0)
+        return;
+    an->entry_of_block[block] = an->entries.size;
+    DYNARRAY_ADD(an->entries, block);
+}
+
+void analyze_frames(const ir_program_t* prog, frame_table_t* table)
+{
+    DYNARRAY_INIT(table->frames, 16);
+    if (prog->ins.size == 0)
+        return;
+
+    analysis_t an;
+    an.prog = prog;
+    cfg_build(prog, &an.cfg);
+
+    int block_count = an.cfg.blocks.size;
+    an.entry_of_block = malloc(block_count * sizeof(int));
+    an.block_label = malloc(block_count * sizeof(int));
+    an.depth_in = malloc(block_count * sizeof(int));
+    an.worklist = malloc(block_count * sizeof(int));
+    an.visited = malloc(block_count * sizeof(int));
+    for (int i = 0; i < block_count; ++i)
+    {
+        an.entry_of_block[i] = -1;
+        an.block_label[i] = -1;
+        an.depth_in[i] = INT_MIN;
+    }
+    for (int i = 0; i < prog->labels.size; ++i)
+    {
+        int block = an.cfg.label_block[i];
+        if (block < 0)
+            continue;
+        if (an.block_label[block] < 0 || ir_label_is_global(&prog->labels.ptr[i]))
+            an.block_label[block] = i;
+    }
+
+    DYNARRAY_INIT(an.entries, 16);
+    add_entry(&an, 0);
+    for (int i = 0; i < prog->labels.size; ++i)
+        if (ir_label_is_global(&prog->labels.ptr[i]))
+            add_entry(&an, an.cfg.label_block[i]);
+    for (int i = 0; i < prog->ins.size; ++i)
+        if (prog->ins.ptr[i].op == OP_call && prog->ins.ptr[i].target >= 0)
+            add_entry(&an, an.cfg.label_block[prog->ins.ptr[i].target]);
+
+    an.summaries = calloc(an.entries.size, sizeof(summary_t));
+
+    // callees first would be enough without recursion, iterate until the summaries are stable
+    int max_iterations = an.entries.size * 2 + 2;
+    for (int iter = 0; iter < max_iterations; ++iter)
+    {
+        int changed = 0;
+        for (int i = 0; i < an.entries.size; ++i)
+        {
+            summary_t summary = analyze_entry(&an, an.entries.ptr[i], 0);
+            if (memcmp(&summary, &an.summaries[i], sizeof(summary_t)) != 0)
+            {
+                an.summaries[i] = summary;
+                changed = 1;
+            }
+        }
+        if (!changed)
+            break;
+    }
+
+    for (int i = 0; i < an.entries.size; ++i)
+    {
+        int block = an.entries.ptr[i];
+        summary_t summary = analyze_entry(&an, block, 1);
+        if (summary.stalled)
+        {
+            fprintf(stderr, "warning : stack effect of some calls in '%s' can't be determined\n", entry_name(&an, block));
+            summary.flags |= FRAME_IMPRECISE;
+        }
+
+        frame_info_t info;
+        info.label = (an.cfg.blocks.ptr[block].start == 0 && an.block_label[block] < 0) ? -1 : an.block_label[block];
+        info.max_stack = summary.max_stack;
+        info.locals = summary.locals;
+        info.args = summary.args;
+        info.net = summary.net;
+        info.flags = summary.flags;
+        DYNARRAY_ADD(table->frames, info);
+    }
+
+    free(an.summaries);
+    free(an.entries.ptr);
+    free(an.entry_of_block);
+    free(an.block_label);
+    free(an.depth_in);
+    free(an.worklist);
+    free(an.visited);
+    cfg_free(&an.cfg);
+}
+
+typedef struct frame_entry_t
+{
+    uint32_t addr;
+    const frame_info_t* info;
+} frame_entry_t;
+
+static int frame_entry_cmp(const void* vlhs, const void* vrhs)
+{
+    const frame_entry_t* lhs = vlhs;
+    const frame_entry_t* rhs = vrhs;
+
+    return (lhs->addr > rhs->addr) - (lhs->addr < rhs->addr);
+}
+
+void emit_frame_section(asm_unit_t* unit, const ir_program_t* prog, const frame_table_t* table)
+{
+    frame_entry_t* entries = malloc((table->frames.size + 1) * sizeof(frame_entry_t));
+    for (int i = 0; i < table->frames.size; ++i)
+    {
+        const frame_info_t* info = &table->frames.ptr[i];
+        entries[i].info = info;
+        entries[i].addr = info->label < 0 ? 0 : unit->label_handles.ptr[prog->labels.ptr[info->label].handle].addr;
+    }
+    qsort(entries, table->frames.size, sizeof(frame_entry_t), frame_entry_cmp);
+
+    image_section_t* section = image_add_section(unit, "FRAM");
+    image_section_put_u32(section, table->frames.size);
+    for (int i = 0; i < table->frames.size; ++i)
+    {
+        const frame_info_t* info = entries[i].info;
+        image_section_put_u32(section, entries[i].addr);
+        image_section_put_u16(section, info->max_stack);
+        image_section_put_u16(section, info->locals);
+        image_section_put_u16(section, info->args);
+        image_section_put_u16(section, (uint16_t)(int16_t)info->net);
+        image_section_put_u16(section, info->flags);
+    }
+
+    free(entries);
+}
+
+void free_frame_table(frame_table_t* table)
+{
+    free(table->frames.ptr);
+}
@@ -0,0 +1,43 @@
+#ifndef FRAME_ANALYSIS_H_INCLUDED
+#define FRAME_ANALYSIS_H_INCLUDED
+
+#include "asm_unit_info.h"
+#include "ir.h"
+
+// Static operand stack depth and local slot count of each function, so that the VM can preallocate
+// exact frames instead of checking every push.
+// Functions are the global labels and the call targets. Each one is walked along its control flow
+// from a depth of 0. Calls use the callee's own summary, and recursion is solved by iterating.
+
+#define FRAME_IMPRECISE  0x1 // indirect calls, stackcpy or syscalls whose stack effect isn't known
+#define FRAME_UNBALANCED 0x2 // different depths where paths merge, or at different 'ret'
+#define FRAME_NO_RETURN  0x4 // no 'ret' is reachable
+
+typedef struct frame_info_t
+{
+    int label;     // entry label, -1 for the start of the code
+    int max_stack; // maximum depth above the entry depth
+    int locals;    // highest local slot used + 1
+    int args;      // values taken from the caller's stack
+    int net;       // depth change between the entry and 'ret'
+    int flags;
+} frame_info_t;
+
+typedef struct frame_table_t
+{
+    DYNARRAY(frame_info_t) frames;
+} frame_table_t;
+
+// operand stack effect of a single instruction, returns 0 when it isn't known statically :
+// call and calli (depend on the callee), stackcpy and unknown syscalls
+int instruction_stack_effect(const ir_ins_t* ins, int* pops, int* pushes);
+
+// warns on stderr about imbalances
+void analyze_frames(const ir_program_t* prog, frame_table_t* table);
+// adds the "FRAM" section : uint32_t count, then sorted by address :
+//   uint32_t address, uint16_t max_stack, uint16_t locals, uint16_t args, int16_t net, uint16_t flags
+// must be called once the program has been lowered into 'unit'
+void emit_frame_section(asm_unit_t* unit, const ir_program_t* prog, const frame_table_t* table);
+void free_frame_table(frame_table_t* table);
+
+#endif // FRAME_ANALYSIS_H_INCLUDED
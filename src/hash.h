@@ -2,16 +2,77 @@
 #define HASH_H_INCLUDED
 
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 
-uint64_t str_hash(const char *str)
+// wyhash-style hash : 8 bytes at a time, each step folds a 64x64->128 bit multiplication,
+// so that keys differing only by a few digits (.L123, .L124, ...) still spread over the whole range.
+
+#define HASH_SECRET0 0xa0761d6478bd642full
+#define HASH_SECRET1 0xe7037ed1a0b428dbull
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+    unsigned __int128 r = (unsigned __int128)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t hash_read64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t mem_hash(const void* data, size_t len)
 {
-    uint64_t hash = 5381;
-    uint64_t c;
+    const uint8_t* p = data;
+    uint64_t seed = hash_mix(HASH_SECRET0, HASH_SECRET1);
+    uint64_t a, b;
 
-    while ((c = (uint64_t)*str++))
-        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            size_t mid = (len >> 3) << 2;
+            a = (hash_read32(p) << 32) | hash_read32(p + mid);
+            b = (hash_read32(p + len - 4) << 32) | hash_read32(p + len - 4 - mid);
+        }
+        else if (len > 0)
+        {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else
+    {
+        size_t i = len;
+        while (i > 16)
+        {
+            seed = hash_mix(hash_read64(p) ^ HASH_SECRET1, hash_read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = hash_read64(p + i - 16);
+        b = hash_read64(p + i - 8);
+    }
 
-    return hash;
+    unsigned __int128 r = (unsigned __int128)(a ^ HASH_SECRET1) * (b ^ seed);
+    return hash_mix((uint64_t)r ^ HASH_SECRET0 ^ len, (uint64_t)(r >> 64) ^ HASH_SECRET1);
+}
+
+static inline uint64_t str_hash(const char *str)
+{
+    return mem_hash(str, strlen(str));
 }
 
 #endif // HASH_H_INCLUDED
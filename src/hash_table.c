@@ -14,20 +14,57 @@ hash_table_t mk_hash_table(size_t bucket_count)
     return table;
 }
 
-void hash_table_insert(hash_table_t* table, const char* key, hash_value_t val)
+static void hash_table_grow(hash_table_t* table)
+{
+    size_t new_count = table->bucket_count*2 + 1;
+    hash_node_t** new_buckets = malloc(sizeof(hash_node_t*)*new_count);
+    hash_node_t** tails = malloc(sizeof(hash_node_t*)*new_count);
+    memset(new_buckets, 0, sizeof(hash_node_t*)*new_count);
+
+    // keep the insertion order inside each chain, so that duplicate keys still resolve to the first one
+    for (size_t i = 0; i < table->bucket_count; ++i)
+    {
+        hash_node_t* chain = table->buckets[i];
+        while (chain)
+        {
+            hash_node_t* next = chain->next_node;
+            size_t idx = chain->hash % new_count;
+
+            chain->next_node = NULL;
+            if (new_buckets[idx] == NULL)
+                new_buckets[idx] = chain;
+            else
+                tails[idx]->next_node = chain;
+            tails[idx] = chain;
+
+            chain = next;
+        }
+    }
+
+    free(tails);
+    free(table->buckets);
+    table->buckets = new_buckets;
+    table->bucket_count = new_count;
+}
+
+void hash_table_insert_hashed(hash_table_t* table, const char* key, uint64_t hash, hash_value_t val)
 {
-    int hash = str_hash(key) % table->bucket_count;
+    if ((size_t)table->count >= table->bucket_count*2)
+        hash_table_grow(table);
+
+    size_t idx = hash % table->bucket_count;
 
     hash_node_t* new_node = malloc(sizeof(hash_node_t));
     new_node->key = key;
+    new_node->hash = hash;
     new_node->value = val;
     new_node->next_node = NULL;
 
-    if (table->buckets[hash] == NULL)
-        table->buckets[hash] = new_node;
+    if (table->buckets[idx] == NULL)
+        table->buckets[idx] = new_node;
     else
     {
-        hash_node_t* chain = table->buckets[hash];
+        hash_node_t* chain = table->buckets[idx];
         while (chain->next_node != NULL)
             chain = chain->next_node;
 
@@ -37,15 +74,15 @@ void hash_table_insert(hash_table_t* table, const char* key, hash_value_t val)
     ++table->count;
 }
 
-hash_value_t* hash_table_get(hash_table_t* table, const char* key)
+hash_value_t* hash_table_get_hashed(hash_table_t* table, const char* key, uint64_t hash)
 {
-    int hash = str_hash(key) % table->bucket_count;
+    size_t idx = hash % table->bucket_count;
 
-    hash_node_t* chain = table->buckets[hash];
+    hash_node_t* chain = table->buckets[idx];
     while (chain)
     {
         // match
-        if (strcmp(chain->key, key) == 0)
+        if (chain->hash == hash && strcmp(chain->key, key) == 0)
             return &chain->value;
 
         chain = chain->next_node;
@@ -54,31 +91,45 @@ hash_value_t* hash_table_get(hash_table_t* table, const char* key)
     return NULL;
 }
 
-void hash_table_remove(hash_table_t* table, const char* key)
+void hash_table_remove_hashed(hash_table_t* table, const char* key, uint64_t hash)
 {
-    int hash = str_hash(key) % table->bucket_count;
+    size_t idx = hash % table->bucket_count;
 
     hash_node_t* previous = NULL;
-    hash_node_t* chain = table->buckets[hash];
+    hash_node_t* chain = table->buckets[idx];
     while (chain)
     {
         // match
-        if (strcmp(chain->key, key) == 0)
+        if (chain->hash == hash && strcmp(chain->key, key) == 0)
         {
             if (previous)
                 previous->next_node = chain->next_node;
             else
-                table->buckets[hash] = chain->next_node;
+                table->buckets[idx] = chain->next_node;
             free(chain);
 
+            --table->count;
             break;
         }
 
         previous = chain;
         chain = chain->next_node;
     }
+}
+
+void hash_table_insert(hash_table_t* table, const char* key, hash_value_t val)
+{
+    hash_table_insert_hashed(table, key, str_hash(key), val);
+}
 
-    --table->count;
+hash_value_t* hash_table_get(hash_table_t* table, const char* key)
+{
+    return hash_table_get_hashed(table, key, str_hash(key));
+}
+
+void hash_table_remove(hash_table_t* table, const char* key)
+{
+    hash_table_remove_hashed(table, key, str_hash(key));
 }
 
 void  hash_table_clear(hash_table_t* table)
@@ -97,6 +148,8 @@ void  hash_table_clear(hash_table_t* table)
             table->buckets[i] = NULL;
         }
 
+    free(table->buckets);
+    table->buckets = NULL;
     table->bucket_count = 0;
     table->count = 0;
 }
@@ -4,10 +4,12 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+struct token_t;
+
 typedef union hash_value_t
 {
     void* ptr;
-    void(*fn_ptr)(const char*, void*);
+    void(*fn_ptr)(const struct token_t*, void*);
     int idx;
     const char* str;
 } hash_value_t;
@@ -15,6 +17,7 @@ typedef union hash_value_t
 typedef struct hash_node_t
 {
     const char* key;
+    uint64_t hash;
     union  hash_value_t value;
     struct hash_node_t* next_node;
 } hash_node_t;
@@ -26,6 +29,7 @@ typedef struct hash_table_t
     hash_node_t** buckets;
 } hash_table_t;
 
+// the table grows when there are more than two entries per bucket on average
 hash_table_t mk_hash_table(size_t bucket_count);
 
 void          hash_table_insert(hash_table_t* table, const char* key, hash_value_t val);
@@ -34,4 +38,9 @@ void          hash_table_remove(hash_table_t* table, const char* key);
 void          hash_table_clear(hash_table_t* table);
 void          hash_table_iterate(hash_table_t* table, void (*callback)(hash_node_t*));
 
+// same, with a key already hashed with str_hash/mem_hash
+void          hash_table_insert_hashed(hash_table_t* table, const char* key, uint64_t hash, hash_value_t val);
+hash_value_t* hash_table_get_hashed(hash_table_t* table, const char* key, uint64_t hash);
+void          hash_table_remove_hashed(hash_table_t* table, const char* key, uint64_t hash);
+
 #endif // HASH_TABLE_H_INCLUDED
@@ -0,0 +1,91 @@
+#include "image.h"
+
+#include <string.h>
+
+uint32_t image_init_address(asm_unit_t* unit)
+{
+    hash_value_t* init_addr_node = hash_table_get(&unit->labels, "_global_init");
+    if (!init_addr_node)
+    {
+        printf("warning : no '_global_init' symbol !\n");
+        return 0;
+    }
+
+    return init_addr_node->idx;
+}
+
+void image_write_header(FILE* file, uint32_t init_addr, int string_count, int extended)
+{
+    // write the signature
+    fwrite(extended ? "DNPE" : "DNPX", 1, 4, file);
+
+    // write main symbol location :
+    fwrite(&init_addr, sizeof(uint32_t), 1, file);
+    if (string_count >= 0x10000)
+    {
+        printf("warning : string table size is too large (doesn't fit in 16-bit) !\n");
+    }
+    // write string table size :
+    uint16_t count = string_count;
+    fwrite(&count, sizeof(uint16_t), 1, file);
+}
+
+void image_write_string(FILE* file, const char* str, uint16_t len)
+{
+    // string len
+    fwrite(&len, sizeof(uint16_t), 1, file);
+    // string data
+    fwrite(str, sizeof(char), len, file);
+}
+
+void image_write_sections(FILE* file, asm_unit_t* unit)
+{
+    if (unit->sections.size == 0)
+        return;
+
+    uint16_t count = unit->sections.size;
+    fwrite(&count, sizeof(uint16_t), 1, file);
+    for (int i = 0; i < unit->sections.size; ++i)
+    {
+        image_section_t* section = &unit->sections.ptr[i];
+        uint32_t size = section->data.size;
+        fwrite(section->tag, 1, 4, file);
+        fwrite(&size, sizeof(uint32_t), 1, file);
+        fwrite(section->data.ptr, 1, section->data.size, file);
+    }
+}
+
+image_section_t* image_add_section(asm_unit_t* unit, const char* tag)
+{
+    image_section_t section;
+    memcpy(section.tag, tag, 4);
+    DYNARRAY_INIT(section.data, 256);
+    DYNARRAY_ADD(unit->sections, section);
+
+    return &unit->sections.ptr[unit->sections.size - 1];
+}
+
+void image_section_put_u16(image_section_t* section, uint16_t val)
+{
+    DYNARRAY_RESIZE(section->data, section->data.size + 2);
+    memcpy(section->data.ptr + section->data.size - 2, &val, 2);
+}
+
+void image_section_put_u32(image_section_t* section, uint32_t val)
+{
+    DYNARRAY_RESIZE(section->data, section->data.size + 4);
+    memcpy(section->data.ptr + section->data.size - 4, &val, 4);
+}
+
+void write_image(FILE* file, asm_unit_t* unit)
+{
+    image_write_header(file, image_init_address(unit), unit->strings.size, unit->sections.size != 0);
+    for (int i = 0; i < unit->strings.size; ++i)
+    {
+        printf("string %d : '%s' (len: %d)\n", i, unit->strings.ptr[i].str, unit->strings.ptr[i].len);
+        image_write_string(file, unit->strings.ptr[i].str, unit->strings.ptr[i].len);
+    }
+    image_write_sections(file, unit);
+
+    fwrite(unit->object_buffer.ptr, 1, unit->object_buffer.size, file);
+}
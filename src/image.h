@@ -0,0 +1,33 @@
+#ifndef IMAGE_H_INCLUDED
+#define IMAGE_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "asm_unit_info.h"
+
+// DNPX image layout :
+//   "DNPX"
+//   uint32_t _global_init address
+//   uint16_t string count, then for each string (sorted by id) : uint16_t length, data
+//   code
+//
+// Units with optional sections use the "DNPE" signature instead, and the sections go between the
+// string table and the code :
+//   uint16_t section count, then for each section : char tag[4], uint32_t size, data
+
+uint32_t image_init_address(asm_unit_t* unit);
+
+void image_write_header(FILE* file, uint32_t init_addr, int string_count, int extended);
+void image_write_string(FILE* file, const char* str, uint16_t len);
+void image_write_sections(FILE* file, asm_unit_t* unit);
+
+// adds an empty section, the returned pointer is valid until the next section is added
+image_section_t* image_add_section(asm_unit_t* unit, const char* tag);
+void image_section_put_u16(image_section_t* section, uint16_t val);
+void image_section_put_u32(image_section_t* section, uint32_t val);
+
+// writes the whole image of an in-memory unit
+void write_image(FILE* file, asm_unit_t* unit);
+
+#endif // IMAGE_H_INCLUDED
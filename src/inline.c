@@ -0,0 +1,280 @@
+#include "inline.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cfg.h"
+
+#define INLINE_MAX_LOCALS 64 // locals tracked by the definition analysis
+#define LOCAL_COUNT_LIMIT 0x10000
+
+typedef struct bound_label_t
+{
+    int pos;
+    int label;
+} bound_label_t;
+
+typedef struct callee_t
+{
+    int eligible;
+    int start, end; // instruction range
+    int ret;        // position of the 'ret'
+    int locals;
+    DYNARRAY(bound_label_t) labels; // labels bound inside the function, by position
+} callee_t;
+
+static int reads_local(opcode_t op)
+{
+    return ir_uses_local(op) && op != OP_movl;
+}
+
+// every local must be written before being read, along every path from the entry
+static int locals_defined_before_use(const ir_program_t* prog, const cfg_t* cfg, int first_block, int last_block)
+{
+    int count = last_block - first_block;
+    uint64_t* defined_in = malloc(count * sizeof(uint64_t));
+    defined_in[0] = 0;
+    for (int i = 1; i < count; ++i)
+        defined_in[i] = ~(uint64_t)0;
+
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            const basic_block_t* block = &cfg->blocks.ptr[first_block + i];
+            uint64_t defined = defined_in[i];
+            for (int j = block->start; j < block->end; ++j)
+                if (prog->ins.ptr[j].op == OP_movl)
+                    defined |= (uint64_t)1 << prog->ins.ptr[j].operand.var;
+
+            int successors[2] = {block->branch, block->fallthrough};
+            for (int k = 0; k < 2; ++k)
+            {
+                int next = successors[k] - first_block;
+                if (successors[k] < 0 || next <= 0 || next >= count)
+                    continue;
+                if ((defined_in[next] & defined) != defined_in[next])
+                {
+                    defined_in[next] &= defined;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    int result = 1;
+    for (int i = 0; i < count && result; ++i)
+    {
+        const basic_block_t* block = &cfg->blocks.ptr[first_block + i];
+        uint64_t defined = defined_in[i];
+        for (int j = block->start; j < block->end; ++j)
+        {
+            const ir_ins_t* ins = &prog->ins.ptr[j];
+            if (reads_local(ins->op) && !(defined & (uint64_t)1 << ins->operand.var))
+            {
+                result = 0;
+                break;
+            }
+            if (ins->op == OP_movl)
+                defined |= (uint64_t)1 << ins->operand.var;
+        }
+    }
+
+    free(defined_in);
+    return result;
+}
+
+static void check_callee(const ir_program_t* prog, const cfg_t* cfg, int first_block, int last_block,
+                         int max_size, callee_t* callee)
+{
+    callee->eligible = 0;
+    if (callee->end - callee->start > max_size)
+        return;
+
+    int rets = 0;
+    for (int i = callee->start; i < callee->end; ++i)
+    {
+        const ir_ins_t* ins = &prog->ins.ptr[i];
+        if (ins->op == OP_call || ins->op == OP_calli || ins->op == OP_jmpt)
+            return;
+        if (ins->op == OP_ret)
+        {
+            ++rets;
+            callee->ret = i;
+        }
+        if (ir_is_branch(ins->op))
+        {
+            int pos = prog->labels.ptr[ins->target].pos;
+            if (pos < callee->start || pos >= callee->end)
+                return;
+        }
+        if (ir_uses_local(ins->op))
+        {
+            if (ins->operand.var >= INLINE_MAX_LOCALS)
+                return;
+            if (ins->operand.var + 1 > callee->locals)
+                callee->locals = ins->operand.var + 1;
+        }
+    }
+
+    opcode_t last = prog->ins.ptr[callee->end - 1].op;
+    if (rets != 1 || (last != OP_ret && last != OP_jmp))
+        return;
+
+    callee->eligible = locals_defined_before_use(prog, cfg, first_block, last_block);
+}
+
+static int bound_label_cmp(const void* vlhs, const void* vrhs)
+{
+    const bound_label_t* lhs = vlhs;
+    const bound_label_t* rhs = vrhs;
+
+    return lhs->pos - rhs->pos;
+}
+
+void inline_leaf_functions(ir_program_t* prog, int max_size)
+{
+    if (prog->ins.size == 0)
+        return;
+
+    cfg_t cfg;
+    cfg_build(prog, &cfg);
+
+    // functions, and the highest local of each one
+    int function_count = cfg.function_count;
+    callee_t* functions = calloc(function_count, sizeof(callee_t));
+    int* first_block = malloc(function_count * sizeof(int));
+    int* caller_locals = calloc(function_count, sizeof(int));
+    int* ins_function = malloc(prog->ins.size * sizeof(int));
+    for (int i = 0; i < function_count; ++i)
+    {
+        functions[i].start = -1;
+        DYNARRAY_INIT(functions[i].labels, 0);
+    }
+    for (int i = 0; i < cfg.blocks.size; ++i)
+    {
+        const basic_block_t* block = &cfg.blocks.ptr[i];
+        callee_t* fn = &functions[block->function];
+        if (fn->start < 0)
+        {
+            fn->start = block->start;
+            first_block[block->function] = i;
+        }
+        fn->end = block->end;
+        for (int j = block->start; j < block->end; ++j)
+        {
+            ins_function[j] = block->function;
+            if (ir_uses_local(prog->ins.ptr[j].op) && prog->ins.ptr[j].operand.var + 1 > caller_locals[block->function])
+                caller_locals[block->function] = prog->ins.ptr[j].operand.var + 1;
+        }
+    }
+
+    // only functions that start at a global label can be called
+    int* function_at = malloc((prog->ins.size + 1) * sizeof(int));
+    for (int i = 0; i <= prog->ins.size; ++i)
+        function_at[i] = -1;
+    for (int i = 0; i < prog->labels.size; ++i)
+    {
+        const ir_label_t* label = &prog->labels.ptr[i];
+        if (label->pos >= 0 && ir_label_is_global(label))
+            function_at[label->pos] = cfg.blocks.ptr[cfg.label_block[i]].function;
+    }
+    for (int f = 0; f < function_count; ++f)
+    {
+        int last_block = f + 1 < function_count ? first_block[f + 1] : cfg.blocks.size;
+        if (function_at[functions[f].start] == f)
+            check_callee(prog, &cfg, first_block[f], last_block, max_size, &functions[f]);
+    }
+
+    int original_labels = prog->labels.size;
+    for (int i = 0; i < original_labels; ++i)
+    {
+        int pos = prog->labels.ptr[i].pos;
+        if (pos < 0 || pos >= prog->ins.size)
+            continue;
+        callee_t* fn = &functions[ins_function[pos]];
+        if (fn->eligible)
+            DYNARRAY_ADD(fn->labels, (bound_label_t){pos, i});
+    }
+    for (int f = 0; f < function_count; ++f)
+        if (functions[f].eligible)
+            qsort(functions[f].labels.ptr, functions[f].labels.size, sizeof(bound_label_t), bound_label_cmp);
+
+    // rewrite the program, labels are bound to their new position afterwards
+    ir_ins_t* old_ins = prog->ins.ptr;
+    int old_count = prog->ins.size;
+    int* new_pos = malloc((old_count + 1) * sizeof(int));
+    int* copy_of = malloc((original_labels + 1) * sizeof(int));
+    DYNARRAY_INIT(prog->ins, old_count + 64);
+
+    for (int i = 0; i < old_count; ++i)
+    {
+        const ir_ins_t* ins = &old_ins[i];
+        new_pos[i] = prog->ins.size;
+
+        int target_pos = ins->op == OP_call && ins->target >= 0 ? prog->labels.ptr[ins->target].pos : -1;
+        int callee_idx = target_pos >= 0 ? function_at[target_pos] : -1;
+        const callee_t* callee = callee_idx >= 0 ? &functions[callee_idx] : NULL;
+        int base = caller_locals[ins_function[i]];
+        if (!callee || !callee->eligible || base + callee->locals > LOCAL_COUNT_LIMIT)
+        {
+            DYNARRAY_ADD(prog->ins, *ins);
+            continue;
+        }
+
+        for (int j = 0; j < callee->labels.size; ++j)
+        {
+            copy_of[callee->labels.ptr[j].label] = prog->labels.size;
+            DYNARRAY_ADD(prog->labels, (ir_label_t){NULL, 0, -1, -1});
+        }
+        int end_label = -1;
+        if (callee->ret != callee->end - 1)
+        {
+            end_label = prog->labels.size;
+            DYNARRAY_ADD(prog->labels, (ir_label_t){NULL, 0, -1, -1});
+        }
+
+        int next_label = 0;
+        for (int j = callee->start; j < callee->end; ++j)
+        {
+            for (; next_label < callee->labels.size && callee->labels.ptr[next_label].pos == j; ++next_label)
+                prog->labels.ptr[copy_of[callee->labels.ptr[next_label].label]].pos = prog->ins.size;
+
+            ir_ins_t copy = old_ins[j];
+            if (copy.op == OP_ret)
+            {
+                if (end_label < 0)
+                    continue;
+                copy.op = OP_jmp;
+                copy.target = end_label;
+            }
+            else if (copy.target >= 0 && ir_is_branch(copy.op))
+                copy.target = copy_of[copy.target];
+            if (ir_uses_local(copy.op))
+                copy.operand.var += base;
+            DYNARRAY_ADD(prog->ins, copy);
+        }
+        if (end_label >= 0)
+            prog->labels.ptr[end_label].pos = prog->ins.size;
+    }
+    new_pos[old_count] = prog->ins.size;
+
+    // the labels bound to an inlined call now start its copy
+    for (int i = 0; i < original_labels; ++i)
+        if (prog->labels.ptr[i].pos >= 0)
+            prog->labels.ptr[i].pos = new_pos[prog->labels.ptr[i].pos];
+
+    for (int i = 0; i < function_count; ++i)
+        free(functions[i].labels.ptr);
+    free(functions);
+    free(first_block);
+    free(caller_locals);
+    free(ins_function);
+    free(function_at);
+    free(new_pos);
+    free(copy_of);
+    free(old_ins);
+    cfg_free(&cfg);
+}
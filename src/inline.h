@@ -0,0 +1,23 @@
+#ifndef INLINE_H_INCLUDED
+#define INLINE_H_INCLUDED
+
+#include "ir.h"
+
+/*
+ Assembly-time inlining of small leaf functions.
+ A function (a global label, up to the next one) is inlined at its 'call' sites when :
+   - it has at most 'max_size' instructions, and no call, calli or jmpt
+   - it has a single 'ret', and doesn't fall through into the next function
+   - its branches stay inside it
+   - each of its locals is written before being read on every path, since the inlined body doesn't get
+     a fresh frame
+ The body replaces the call : its locals are moved above the ones of the caller, its labels are replaced by
+ anonymous ones and its 'ret' becomes a jump to the end of the copy.
+ The function itself is kept, for the other callers and indirect calls.
+*/
+
+#define INLINE_DEFAULT_SIZE 16
+
+void inline_leaf_functions(ir_program_t* prog, int max_size);
+
+#endif // INLINE_H_INCLUDED
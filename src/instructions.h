@@ -2,10 +2,11 @@
 #define INSTRUCTIONS_H_INCLUDED
 
 #include "hash_table.h"
+#include "opcodes.h"
 
 #include <stdint.h>
 
-hash_table_t ins_callbacks;
+extern hash_table_t ins_callbacks;
 
 void register_instructions();
 
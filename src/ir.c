@@ -0,0 +1,312 @@
+#include "ir.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "builder.h"
+#include "fatal.h"
+
+int ir_label_is_global(const ir_label_t* label)
+{
+    return label->name != NULL && label->name[0] != '.';
+}
+
+int ir_is_terminator(opcode_t op)
+{
+    return op == OP_jt || op == OP_jf || op == OP_jmp || op == OP_jmpt || op == OP_ret;
+}
+
+int ir_is_branch(opcode_t op)
+{
+    return op == OP_jt || op == OP_jf || op == OP_jmp;
+}
+
+int ir_has_label_operand(const ir_ins_t* ins)
+{
+    return ins->target >= 0;
+}
+
+int ir_uses_local(opcode_t op)
+{
+    switch (op)
+    {
+        case OP_pushl:
+        case OP_movl:
+        case OP_copyl:
+        case OP_incl:
+        case OP_decl:
+        case OP_getaddrl:
+        case OP_eql:
+        case OP_neql:
+        case OP_ltl:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int ins_size(opcode_t op)
+{
+    return 1 + operand_size(opcode_infos[op].kind);
+}
+
+// label index of a relocation target
+static int lift_target(ir_program_t* prog, hash_table_t* by_name, const int* handle_label, const reloc_pair_t* reloc)
+{
+    if (reloc->target_label == NULL)
+        return handle_label[reloc->target_handle];
+
+    hash_value_t* val = hash_table_get_hashed(by_name, reloc->target_label, reloc->target_hash);
+    if (!val)
+    {
+        // undefined, the error is reported when resolving
+        DYNARRAY_ADD(prog->labels, (ir_label_t){strdup(reloc->target_label), reloc->target_hash, -1, -1});
+        hash_table_insert_hashed(by_name, prog->labels.ptr[prog->labels.size - 1].name, reloc->target_hash,
+                                 (hash_value_t){.idx = prog->labels.size - 1});
+        return prog->labels.size - 1;
+    }
+
+    return val->idx;
+}
+
+void ir_lift(asm_unit_t* unit, ir_program_t* prog)
+{
+    DYNARRAY_INIT(prog->ins, 256);
+    DYNARRAY_INIT(prog->labels, 64);
+    DYNARRAY_INIT(prog->tables, 0);
+
+    if (unit->code_base != 0)
+    {
+        fprintf(stderr, "streamed units can't be lifted\n");
+        asm_fatal();
+    }
+
+    int size = unit->object_buffer.size;
+    const uint8_t* code = unit->object_buffer.ptr;
+
+    // instruction index at each byte offset, -1 inside an instruction
+    int* ins_at = malloc((size + 1) * sizeof(int));
+    for (int i = 0; i <= size; ++i)
+        ins_at[i] = -1;
+
+    for (int offset = 0; offset < size; )
+    {
+        opcode_t op = code[offset];
+        const opcode_info_t* info = &opcode_infos[op];
+        if (info->name == NULL)
+        {
+            fprintf(stderr, "invalid opcode 0x%02x at offset %d\n", op, offset);
+            asm_fatal();
+        }
+
+        ir_ins_t ins;
+        ins.op = op;
+        ins.operand.i = 0;
+        ins.target = -1;
+        switch (info->kind)
+        {
+            case OPERAND_1OP_I_IMM:
+            case OPERAND_1OP_LBL:
+                ins.operand.i = *(int32_t*)(code + offset + 1);
+                break;
+            case OPERAND_1OP_F_IMM:
+                ins.operand.f = *(float*)(code + offset + 1);
+                break;
+            case OPERAND_1OP_B_IMM:
+                ins.operand.i = *(int8_t*)(code + offset + 1);
+                break;
+            case OPERAND_1OP_VAR:
+            case OPERAND_1OP_TBL:
+                ins.operand.var = *(uint16_t*)(code + offset + 1);
+                break;
+            default:
+                break;
+        }
+
+        ins_at[offset] = prog->ins.size;
+        DYNARRAY_ADD(prog->ins, ins);
+        offset += ins_size(op);
+    }
+    ins_at[size] = prog->ins.size;
+
+    // labels defined in the source, only the first definition of a name is visible
+    hash_table_t by_name = mk_hash_table(unit->labels.count + 1);
+    for (size_t i = 0; i < unit->labels.bucket_count; ++i)
+        for (hash_node_t* node = unit->labels.buckets[i]; node; node = node->next_node)
+        {
+            if (hash_table_get_hashed(&by_name, node->key, node->hash))
+                continue;
+            int pos = ins_at[node->value.idx];
+            if (pos < 0)
+            {
+                fprintf(stderr, "label '%s' is inside an instruction\n", node->key);
+                asm_fatal();
+            }
+            DYNARRAY_ADD(prog->labels, (ir_label_t){node->key, node->hash, -1, pos});
+            hash_table_insert_hashed(&by_name, node->key, node->hash, (hash_value_t){.idx = prog->labels.size - 1});
+        }
+
+    // builder labels
+    int* handle_label = malloc((unit->label_handles.size + 1) * sizeof(int));
+    for (int i = 0; i < unit->label_handles.size; ++i)
+    {
+        const label_handle_t* handle = &unit->label_handles.ptr[i];
+        int pos = handle->addr < 0 ? -1 : ins_at[handle->addr];
+        // named handles are also in the label table
+        hash_value_t* named = handle->name ? hash_table_get(&by_name, handle->name) : NULL;
+        if (named)
+        {
+            prog->labels.ptr[named->idx].handle = i;
+            handle_label[i] = named->idx;
+            continue;
+        }
+        DYNARRAY_ADD(prog->labels, (ir_label_t){handle->name, 0, i, pos});
+        handle_label[i] = prog->labels.size - 1;
+    }
+
+    for (int i = 0; i < unit->relocs.size; ++i)
+    {
+        const reloc_pair_t* reloc = &unit->relocs.ptr[i];
+        prog->ins.ptr[ins_at[reloc->reloc_index - 1]].target = lift_target(prog, &by_name, handle_label, reloc);
+    }
+
+    for (int i = 0; i < unit->tables.size; ++i)
+    {
+        const jump_table_t* table = &unit->tables.ptr[i];
+        ir_table_t ir_table;
+        DYNARRAY_INIT(ir_table.labels, table->entries.size);
+        for (int j = 0; j < table->entries.size; ++j)
+            DYNARRAY_ADD(ir_table.labels, lift_target(prog, &by_name, handle_label, &table->entries.ptr[j]));
+        DYNARRAY_ADD(prog->tables, ir_table);
+    }
+
+    hash_table_clear(&by_name);
+    free(handle_label);
+    free(ins_at);
+}
+
+void ir_lower(ir_program_t* prog, asm_unit_t* unit)
+{
+    // instruction addresses
+    int* addr = malloc((prog->ins.size + 1) * sizeof(int));
+    int offset = 0;
+    for (int i = 0; i < prog->ins.size; ++i)
+    {
+        addr[i] = offset;
+        offset += ins_size(prog->ins.ptr[i].op);
+    }
+    addr[prog->ins.size] = offset;
+
+    // every defined label gets a builder handle, and named ones are moved in the label table
+    for (int i = 0; i < prog->labels.size; ++i)
+    {
+        ir_label_t* label = &prog->labels.ptr[i];
+        if (label->pos < 0)
+            continue;
+
+        if (label->handle < 0)
+            label->handle = asm_new_label(unit, NULL);
+        unit->label_handles.ptr[label->handle].addr = addr[label->pos];
+
+        if (label->name)
+        {
+            hash_value_t* val = hash_table_get_hashed(&unit->labels, label->name, label->hash);
+            if (val)
+                val->idx = addr[label->pos];
+        }
+    }
+
+    for (int i = 0; i < unit->relocs.size; ++i)
+        free((void*)unit->relocs.ptr[i].target_label);
+    unit->relocs.size = 0;
+    unit->object_buffer.size = 0;
+
+    // table entries now point to the handles too
+    for (int i = 0; i < prog->tables.size; ++i)
+    {
+        jump_table_t* table = &unit->tables.ptr[i];
+        for (int j = 0; j < table->entries.size; ++j)
+        {
+            reloc_pair_t* entry = &table->entries.ptr[j];
+            const ir_label_t* label = &prog->labels.ptr[prog->tables.ptr[i].labels.ptr[j]];
+            free((void*)entry->target_label);
+            if (label->handle >= 0)
+                *entry = (reloc_pair_t){0, NULL, 0, label->handle};
+            else
+                *entry = (reloc_pair_t){0, strdup(label->name), label->hash, -1};
+        }
+    }
+
+    for (int i = 0; i < prog->ins.size; ++i)
+    {
+        const ir_ins_t* ins = &prog->ins.ptr[i];
+        if (ins->target >= 0)
+        {
+            const ir_label_t* label = &prog->labels.ptr[ins->target];
+            if (label->handle >= 0)
+                asm_emit_label(unit, ins->op, label->handle);
+            else
+                asm_emit_label_name(unit, ins->op, label->name, label->hash);
+            continue;
+        }
+
+        switch (opcode_infos[ins->op].kind)
+        {
+            case OPERAND_1OP_I_IMM:
+                asm_emit_imm_int(unit, ins->op, ins->operand.i);
+                break;
+            case OPERAND_1OP_F_IMM:
+                asm_emit_imm_float(unit, ins->op, ins->operand.f);
+                break;
+            case OPERAND_1OP_B_IMM:
+                asm_emit_imm_byte(unit, ins->op, (int8_t)ins->operand.i);
+                break;
+            case OPERAND_1OP_VAR:
+                asm_emit_var(unit, ins->op, ins->operand.var);
+                break;
+            case OPERAND_1OP_TBL:
+                asm_emit_table(unit, ins->op, ins->operand.var);
+                break;
+            default:
+                asm_emit_0op(unit, ins->op);
+                break;
+        }
+    }
+
+    free(addr);
+}
+
+void ir_free(ir_program_t* prog)
+{
+    // names of undefined labels are owned by the program
+    for (int i = 0; i < prog->labels.size; ++i)
+        if (prog->labels.ptr[i].pos < 0 && prog->labels.ptr[i].handle < 0)
+            free((void*)prog->labels.ptr[i].name);
+
+    for (int i = 0; i < prog->tables.size; ++i)
+        free(prog->tables.ptr[i].labels.ptr);
+
+    free(prog->ins.ptr);
+    free(prog->labels.ptr);
+    free(prog->tables.ptr);
+}
+
+void ir_remove_instructions(ir_program_t* prog, const uint8_t* dead)
+{
+    int* new_pos = malloc((prog->ins.size + 1) * sizeof(int));
+    int kept = 0;
+    for (int i = 0; i < prog->ins.size; ++i)
+    {
+        new_pos[i] = kept;
+        if (!dead[i])
+            prog->ins.ptr[kept++] = prog->ins.ptr[i];
+    }
+    new_pos[prog->ins.size] = kept;
+    prog->ins.size = kept;
+
+    for (int i = 0; i < prog->labels.size; ++i)
+        if (prog->labels.ptr[i].pos >= 0)
+            prog->labels.ptr[i].pos = new_pos[prog->labels.ptr[i].pos];
+
+    free(new_pos);
+}
@@ -0,0 +1,63 @@
+#ifndef IR_H_INCLUDED
+#define IR_H_INCLUDED
+
+#include <stdint.h>
+
+#include "asm_unit_info.h"
+#include "opcodes.h"
+
+// Instruction-level view of a unit, used by the optimization and analysis passes.
+// It is lifted from a parsed unit before its relocations are resolved, and lowered back into it.
+
+typedef struct ir_ins_t
+{
+    opcode_t op;
+    union
+    {
+        int32_t i; // also holds 8-bit immediates
+        float f;
+        uint16_t var;
+    } operand;
+    int target; // label index for label operands, -1 otherwise
+} ir_ins_t;
+
+typedef struct ir_label_t
+{
+    const char* name; // NULL for anonymous builder labels
+    uint64_t hash;
+    int handle;       // builder label handle, -1 for labels defined in the source
+    int pos;          // index of the instruction the label is bound to, -1 if it's undefined
+} ir_label_t;
+
+// jump table, indexed by the operand of jmpt/loadt
+typedef struct ir_table_t
+{
+    DYNARRAY(int) labels;
+} ir_table_t;
+
+typedef struct ir_program_t
+{
+    DYNARRAY(ir_ins_t) ins;
+    DYNARRAY(ir_label_t) labels;
+    DYNARRAY(ir_table_t) tables;
+} ir_program_t;
+
+// the unit must be parsed but not resolved, and not streamed
+void ir_lift(asm_unit_t* unit, ir_program_t* prog);
+// re-encodes the program into the unit, which can then be resolved as usual
+void ir_lower(ir_program_t* prog, asm_unit_t* unit);
+void ir_free(ir_program_t* prog);
+
+// labels that start a function : named, and not local ('.L...')
+int ir_label_is_global(const ir_label_t* label);
+// jt/jf/jmp/jmpt/ret
+int ir_is_terminator(opcode_t op);
+int ir_is_branch(opcode_t op);
+int ir_has_label_operand(const ir_ins_t* ins);
+// instructions whose 16-bit operand is a local slot
+int ir_uses_local(opcode_t op);
+
+// removes the instructions marked in 'dead', labels on a removed instruction move to the next one kept
+void ir_remove_instructions(ir_program_t* prog, const uint8_t* dead);
+
+#endif // IR_H_INCLUDED
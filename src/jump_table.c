@@ -0,0 +1,45 @@
+#include "jump_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fatal.h"
+#include "image.h"
+#include "parser.h"
+
+void emit_jump_tables(asm_unit_t* unit)
+{
+    if (unit->tables.size == 0)
+        return;
+
+    for (int i = 0; i < unit->tables.size; ++i)
+        if (!unit->tables.ptr[i].defined)
+        {
+            fprintf(stderr, "jump table '%s' is used but never defined\n",
+                    unit->tables.ptr[i].name ? unit->tables.ptr[i].name : "");
+            asm_fatal();
+        }
+
+    image_section_t* section = image_add_section(unit, "JTBL");
+    image_section_put_u16(section, unit->tables.size);
+    for (int i = 0; i < unit->tables.size; ++i)
+    {
+        const jump_table_t* table = &unit->tables.ptr[i];
+        image_section_put_u16(section, table->entries.size);
+        for (int j = 0; j < table->entries.size; ++j)
+            image_section_put_u32(section, reloc_target_address(unit, &table->entries.ptr[j]));
+    }
+}
+
+void free_jump_tables(asm_unit_t* unit)
+{
+    for (int i = 0; i < unit->tables.size; ++i)
+    {
+        jump_table_t* table = &unit->tables.ptr[i];
+        for (int j = 0; j < table->entries.size; ++j)
+            free((void*)table->entries.ptr[j].target_label);
+        free((void*)table->name);
+        free(table->entries.ptr);
+    }
+    unit->tables.size = 0;
+}
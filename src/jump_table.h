@@ -0,0 +1,23 @@
+#ifndef JUMP_TABLE_H_INCLUDED
+#define JUMP_TABLE_H_INCLUDED
+
+#include "asm_unit_info.h"
+
+/*
+ Jump tables, for constant-time dispatch on a small integer (switch statements, opcode handlers...).
+   .table name, label1, label2, ...
+ defines a dense array of code addresses, which can be referenced before or after its definition :
+   jmpt name  : pops an index, jumps to entry 'index'
+   loadt name : pops an index, pushes entry 'index', e.g. followed by 'calli'
+ The operand is the 16-bit index of the table, the index popped at run time isn't checked against
+ the table size.
+ The tables are the "JTBL" image section : uint16_t count, then for each table, in index order :
+   uint16_t entry count, then one uint32_t code offset per entry
+ As for the "ADDR" section of position-independent code, entries are added to the code base when used.
+*/
+
+// resolves the entries and adds the section if the unit has tables, aborts on undefined tables or labels
+void emit_jump_tables(asm_unit_t* unit);
+void free_jump_tables(asm_unit_t* unit);
+
+#endif // JUMP_TABLE_H_INCLUDED
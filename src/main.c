@@ -4,6 +4,16 @@
 
 #include "parser.h"
 #include "instructions.h"
+#include "image.h"
+#include "stream.h"
+#include "builder.h"
+#include "passes.h"
+#include "corpus_stats.h"
+#include "cache.h"
+#include "delta.h"
+#include "batch.h"
+#include "embed.h"
+#include "inline.h"
 
 const char* program =
 "collatz:\n"
@@ -46,12 +56,200 @@ const char* program =
 "syscall #3 // exit\n"
 "ret";
 
-int main()
+static void usage(const char* argv0)
+{
+    fprintf(stderr, "usage : %s [options] [input.dpa | -]\n"
+                    "  -o <file>     output image\n"
+                    "  --stream      assemble in bounded memory (implied when reading from stdin)\n"
+                    "  -O            jump threading, dead code removal and block layout\n"
+                    "  --frame-info  emit the stack depth and local count of each function\n"
+                    "  --pic         position-independent code : relative branches and an address table\n"
+                    "  --const-pool  move repeated immediates to a constant pool when it makes the code smaller\n"
+                    "  --inline      inline small leaf functions at their call sites\n"
+                    "  --inline-size N  largest function inlined, in instructions (default 16)\n"
+                    "  --register-code  also emit a register bytecode translation of the code\n"
+                    "  --format dnpx|elf|c  image, linkable ELF object or C array\n"
+                    "  --symbol-name <s>    prefix of the symbols exported by --format elf|c (default : output name)\n"
+                    "  --stats <dir> opcode n-gram statistics of every .dpa file in <dir>, written to -o or stdout\n"
+                    "  --profile <f> weight the statistics with 'path,code offset,count' lines\n"
+                    "  --stats-format csv|json\n"
+                    "  --stats-top N entries per table (default 100, 0 for all)\n"
+                    "  -j N          statistics threads (default one per CPU)\n"
+                    "  --cache <dir> reuse the image of an identical source, options and assembler version\n"
+                    "  --cache-size <MiB> evict the least recently used images above this size (default 1024)\n"
+                    "  --cache-stats print the cache hit and miss counters\n"
+                    "  --symbols <f> write the symbol map of the output\n"
+                    "  --delta <image> <map>  write a hot reload patch against a running image and its symbol map\n"
+                    "  --patched <f> with --delta, also write the image the VM ends up with\n"
+                    "  --batch <list> assemble every '<input> [output]' line of <list>\n"
+                    "  --batch-io pread  don't use io_uring for --batch\n", argv0);
+}
+
+int main(int argc, char** argv)
 {
     const char* filename = "asm.dpa";
     const char* out_name = "D:/Compiegne C++/Projets C++/DanPaVM/build/in.bin";
+    int out_given = 0;
+    int streaming = 0;
+    asm_options_t options = {0};
+    stats_options_t stats = {0};
+    stats.top = 100;
+    const char* cache_dir = NULL;
+    uint64_t cache_size = 1024;
+    int cache_stats = 0;
+    delta_options_t delta = {0};
+    const char* batch_list = NULL;
+    batch_io_t batch_io = BATCH_IO_AUTO;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+        {
+            out_name = argv[++i];
+            out_given = 1;
+        }
+        else if (strcmp(argv[i], "--stream") == 0)
+            streaming = 1;
+        else if (strcmp(argv[i], "-O") == 0)
+            options.optimize_cfg = 1;
+        else if (strcmp(argv[i], "--frame-info") == 0)
+            options.frame_info = 1;
+        else if (strcmp(argv[i], "--pic") == 0)
+            options.pic = 1;
+        else if (strcmp(argv[i], "--const-pool") == 0)
+            options.const_pool = 1;
+        else if (strcmp(argv[i], "--inline") == 0)
+        {
+            if (!options.inline_size)
+                options.inline_size = INLINE_DEFAULT_SIZE;
+        }
+        else if (strcmp(argv[i], "--inline-size") == 0 && i+1 < argc)
+            options.inline_size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--register-code") == 0)
+            options.register_code = 1;
+        else if (strcmp(argv[i], "--format") == 0 && i+1 < argc)
+        {
+            const char* format = argv[++i];
+            if (strcmp(format, "elf") == 0)
+                options.output_format = OUTPUT_ELF;
+            else if (strcmp(format, "c") == 0)
+                options.output_format = OUTPUT_C;
+            else if (strcmp(format, "dnpx") != 0)
+            {
+                usage(argv[0]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--symbol-name") == 0 && i+1 < argc)
+            options.symbol_name = argv[++i];
+        else if (strcmp(argv[i], "--stats") == 0 && i+1 < argc)
+            stats.directory = argv[++i];
+        else if (strcmp(argv[i], "--profile") == 0 && i+1 < argc)
+            stats.profile = argv[++i];
+        else if (strcmp(argv[i], "--stats-format") == 0 && i+1 < argc)
+        {
+            const char* format = argv[++i];
+            if (strcmp(format, "json") == 0)
+                stats.format = STATS_JSON;
+            else if (strcmp(format, "csv") != 0)
+            {
+                usage(argv[0]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--stats-top") == 0 && i+1 < argc)
+            stats.top = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0 && i+1 < argc)
+            stats.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--cache") == 0 && i+1 < argc)
+            cache_dir = argv[++i];
+        else if (strcmp(argv[i], "--cache-size") == 0 && i+1 < argc)
+            cache_size = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--cache-stats") == 0)
+            cache_stats = 1;
+        else if (strcmp(argv[i], "--symbols") == 0 && i+1 < argc)
+            delta.symbols = argv[++i];
+        else if (strcmp(argv[i], "--delta") == 0 && i+2 < argc)
+        {
+            delta.base_image = argv[++i];
+            delta.base_map = argv[++i];
+        }
+        else if (strcmp(argv[i], "--patched") == 0 && i+1 < argc)
+            delta.patched_image = argv[++i];
+        else if (strcmp(argv[i], "--batch") == 0 && i+1 < argc)
+            batch_list = argv[++i];
+        else if (strcmp(argv[i], "--batch-io") == 0 && i+1 < argc)
+        {
+            if (strcmp(argv[++i], "pread") == 0)
+                batch_io = BATCH_IO_PREAD;
+            else if (strcmp(argv[i], "auto") != 0)
+            {
+                usage(argv[0]);
+                return -1;
+            }
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0')
+        {
+            usage(argv[0]);
+            return -1;
+        }
+        else
+            filename = argv[i];
+    }
+
+    register_instructions();
+
+    if (stats.directory)
+    {
+        stats.output = out_given ? out_name : NULL;
+        return run_corpus_stats(&stats);
+    }
+
+    if (options.output_format != OUTPUT_DNPX && (streaming || strcmp(filename, "-") == 0 || delta.base_image))
+    {
+        fprintf(stderr, "--format elf|c can't be combined with streaming or --delta\n");
+        return -1;
+    }
+
+    // the register code refers to absolute code addresses
+    if (options.pic && options.register_code)
+    {
+        fprintf(stderr, "--register-code can't be combined with --pic\n");
+        return -1;
+    }
+
+    if (batch_list)
+        return assemble_batch(batch_list, &options, batch_io) == 0 ? 0 : -1;
+
+    if ((streaming || strcmp(filename, "-") == 0) && (options.optimize_cfg || options.frame_info || options.pic || options.const_pool
+                                                         || options.register_code || options.inline_size))
+        fprintf(stderr, "warning : optimizations, analyses and --pic are ignored when streaming\n");
+    if ((streaming || strcmp(filename, "-") == 0) && cache_dir)
+        fprintf(stderr, "warning : the output cache is not used when streaming\n");
+
+    if (cache_dir && (delta.symbols || delta.base_image))
+    {
+        fprintf(stderr, "warning : the output cache is not used with --symbols or --delta\n");
+        cache_dir = NULL;
+    }
+
+    if (strcmp(filename, "-") == 0)
+        return assemble_stream(stdin, out_name);
 
     FILE *input = fopen(filename, "rb");
+    if (!input)
+    {
+        fprintf(stderr, "could not open input file '%s'\n", filename);
+        return -1;
+    }
+
+    if (streaming)
+    {
+        int result = assemble_stream(input, out_name);
+        fclose(input);
+        return result;
+    }
+
     fseek(input, 0, SEEK_END);
     long fsize = ftell(input);
     rewind(input);  /* same as rewind(f); */
@@ -67,50 +265,86 @@ int main()
     source_buffer[fsize] = '\0';
     fclose(input);
 
-    register_instructions();
+    // the symbol names are part of the output, and of its cache key
+    char* default_symbol = NULL;
+    if (options.output_format != OUTPUT_DNPX && !options.symbol_name)
+        options.symbol_name = default_symbol = default_symbol_name(out_name);
+
+    output_cache_t cache;
+    if (cache_dir)
+    {
+        if (cache_open(&cache, cache_dir, cache_size << 20) != 0)
+            return -1;
+        cache_make_key(&cache, source_buffer, fsize, &options);
+        if (cache_fetch(&cache, out_name))
+        {
+            if (cache_stats)
+                cache_print_stats(&cache, stderr);
+            free(source_buffer);
+            return 0;
+        }
+    }
 
     asm_unit_t unit;
-    unit.source = source_buffer;
-    parse_file(&unit);
+    parse_init(&unit);
+    unit.source = (const char*)source_buffer;
+    unit.pic = options.pic;
+    parse_source(&unit, unit.source);
+    run_passes(&unit, &options);
 
     // write output file
+    detach_output(out_name);
     FILE* file = fopen(out_name, "wb");
-
-    // write the signature
-    fwrite("DNPX", 1, 4, file);
-    hash_value_t* init_addr_node = hash_table_get(&unit.labels, "_global_init");
-    uint32_t addr = 0;
-    if (!init_addr_node)
-        printf("warning : no '_global_init' symbol !\n");
-    else
-        addr = init_addr_node->idx;
-
-    // write main symbol location :
-    fwrite(&addr, sizeof(uint32_t), 1, file);
-    if (unit.strings.size >= 0x10000)
+    if (!file)
     {
-        printf("warning : string table size is too large (doesn't fit in 16-bit) !\n");
+        fprintf(stderr, "could not open output file '%s'\n", out_name);
+        return -1;
     }
-    // write string table size :
-    fwrite(&unit.strings.size, sizeof(uint16_t), 1, file);
-    for (int i = 0; i < unit.strings.size; ++i)
+
+    if (delta.base_image)
     {
-        printf("string %d : '%s' (len: %d)\n", i, unit.strings.ptr[i].str, unit.strings.ptr[i].len);
-        // string len
-        fwrite(&unit.strings.ptr[i].len, sizeof(uint16_t), 1, file);
-        // string data
-        fwrite(unit.strings.ptr[i].str, sizeof(char), unit.strings.ptr[i].len, file);
+        sort_strings(&unit);
+        int result = write_delta(file, &unit, &delta);
+        free_asm_unit(&unit);
+        free(source_buffer);
+        fclose(file);
+        return result;
+    }
 
-        free((void*)unit.strings.ptr[i].str);
+    asm_finish(&unit);
+    if (write_output(file, &unit, &options, out_name) != 0)
+    {
+        fprintf(stderr, "could not write output file '%s'\n", out_name);
+        return -1;
     }
 
-    fwrite(unit.object_buffer.ptr, 1, unit.object_buffer.size, file);
+    if (delta.symbols)
+    {
+        FILE* symbols = fopen(delta.symbols, "w");
+        if (!symbols)
+        {
+            fprintf(stderr, "could not open output file '%s'\n", delta.symbols);
+            return -1;
+        }
+        symbol_map_t map;
+        collect_functions(&unit, &map);
+        write_symbol_map(symbols, &map);
+        free_symbol_map(&map);
+        fclose(symbols);
+    }
 
-    free(unit.object_buffer.ptr);
-    free(unit.relocs.ptr);
-    free(unit.strings.ptr);
-    hash_table_clear(&unit.labels);
+    free_asm_unit(&unit);
+    free(source_buffer);
+    free(default_symbol);
 
     fclose(file);
+
+    if (cache_dir)
+    {
+        cache_store(&cache, out_name);
+        if (cache_stats)
+            cache_print_stats(&cache, stderr);
+    }
+
     return 0;
 }
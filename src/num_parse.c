@@ -0,0 +1,680 @@
+#include "num_parse.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 8 bytes at a time helpers (SWAR), the first character ends up in the lowest byte
+
+static inline uint64_t load_u64(const char* str)
+{
+    uint64_t val;
+    memcpy(&val, str, sizeof(val));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap64(val);
+#endif
+    return val;
+}
+
+#define SWAR_ONES  0x0101010101010101ull
+#define SWAR_HIGHS 0x8080808080808080ull
+
+// high bit of each byte set if lo <= byte <= hi, bytes are assumed to be < 0x80
+static inline uint64_t swar_in_range(uint64_t val, uint8_t lo, uint8_t hi)
+{
+    uint64_t ge_lo = val + (0x80 - lo)*SWAR_ONES;
+    uint64_t gt_hi = val + (0x7F - hi)*SWAR_ONES;
+
+    return ge_lo & ~gt_hi & SWAR_HIGHS;
+}
+
+static inline int swar_is_8_digits(uint64_t val)
+{
+    return (((val & 0xF0F0F0F0F0F0F0F0ull) | (((val + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4))
+            == 0x3333333333333333ull);
+}
+
+static inline uint32_t swar_parse_8_digits(uint64_t val)
+{
+    const uint64_t mask = 0x000000FF000000FFull;
+    const uint64_t mul1 = 0x000F424000000064ull; // 100 + (1000000ULL << 32)
+    const uint64_t mul2 = 0x0000271000000001ull; // 1 + (10000ULL << 32)
+    val -= 0x3030303030303030ull;
+    val = (val * 10) + (val >> 8);
+    val = (((val & mask) * mul1) + (((val >> 16) & mask) * mul2)) >> 32;
+
+    return (uint32_t)val;
+}
+
+// returns 0 if one of the 8 characters isn't an hex digit
+static inline int swar_parse_8_hex(uint64_t val, uint32_t* out)
+{
+    if (val & SWAR_HIGHS)
+        return 0;
+
+    uint64_t digits = swar_in_range(val, '0', '9');
+    uint64_t alphas = swar_in_range(val | 0x2020202020202020ull, 'a', 'f');
+    if ((digits | alphas) != SWAR_HIGHS)
+        return 0;
+
+    // nibble value of each byte, then pack them together, most significant first
+    val = (val & 0x0F0F0F0F0F0F0F0Full) + (alphas >> 7)*9;
+    val = ((val << 4) | (val >> 8))  & 0x00FF00FF00FF00FFull;
+    val = ((val << 8) | (val >> 16)) & 0x0000FFFF0000FFFFull;
+    val = ((val << 16) | (val >> 32)) & 0x00000000FFFFFFFFull;
+
+    *out = (uint32_t)val;
+    return 1;
+}
+
+static inline int hex_digit_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// parses an unsigned decimal number, fails if the value is larger than 'max'
+static num_status_t parse_dec_digits(const char* str, size_t len, uint64_t max, uint64_t* out)
+{
+    if (len == 0)
+        return NUM_EMPTY;
+
+    size_t i = 0;
+    while (i < len && str[i] == '0')
+        ++i;
+    size_t first_significant = i;
+    uint64_t acc = 0;
+
+    while (len - i >= 8)
+    {
+        uint64_t chunk = load_u64(str + i);
+        if (!swar_is_8_digits(chunk))
+            break;
+        // 20 digits can overflow an uint64_t, and max is never above that
+        if (i + 8 - first_significant > 19)
+            return NUM_OVERFLOW;
+        acc = acc*100000000 + swar_parse_8_digits(chunk);
+        i += 8;
+    }
+    for (; i < len; ++i)
+    {
+        unsigned digit = (unsigned char)str[i] - '0';
+        if (digit > 9)
+            return NUM_INVALID;
+        if (i + 1 - first_significant > 19)
+            return NUM_OVERFLOW;
+        acc = acc*10 + digit;
+    }
+
+    if (acc > max)
+        return NUM_OVERFLOW;
+
+    *out = acc;
+    return NUM_OK;
+}
+
+static num_status_t parse_hex_digits(const char* str, size_t len, uint64_t max, uint64_t* out)
+{
+    if (len == 0)
+        return NUM_EMPTY;
+
+    size_t i = 0;
+    while (i < len && str[i] == '0')
+        ++i;
+    size_t first_significant = i;
+    uint64_t acc = 0;
+
+    while (len - i >= 8)
+    {
+        uint32_t chunk;
+        if (!swar_parse_8_hex(load_u64(str + i), &chunk))
+            break;
+        if (i + 8 - first_significant > 16)
+            return NUM_OVERFLOW;
+        acc = (acc << 32) | chunk;
+        i += 8;
+    }
+    for (; i < len; ++i)
+    {
+        int digit = hex_digit_value(str[i]);
+        if (digit < 0)
+            return NUM_INVALID;
+        if (i + 1 - first_significant > 16)
+            return NUM_OVERFLOW;
+        acc = (acc << 4) | digit;
+    }
+
+    if (acc > max)
+        return NUM_OVERFLOW;
+
+    *out = acc;
+    return NUM_OK;
+}
+
+static num_status_t parse_oct_digits(const char* str, size_t len, uint64_t max, uint64_t* out)
+{
+    uint64_t acc = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        unsigned digit = (unsigned char)str[i] - '0';
+        if (digit > 7)
+            return NUM_INVALID;
+        acc = acc*8 + digit;
+        if (acc > max)
+            return NUM_OVERFLOW;
+    }
+
+    *out = acc;
+    return NUM_OK;
+}
+
+num_status_t parse_int32(const char* str, size_t len, int32_t* out)
+{
+    int negative = 0;
+    if (len > 0 && (str[0] == '-' || str[0] == '+'))
+    {
+        negative = str[0] == '-';
+        ++str; --len;
+    }
+    if (len == 0)
+        return NUM_EMPTY;
+
+    uint64_t max = negative ? (uint64_t)INT32_MAX + 1 : UINT32_MAX;
+    uint64_t val;
+    num_status_t status;
+    if (len >= 2 && str[0] == '0' && (str[1] | 0x20) == 'x')
+        status = parse_hex_digits(str + 2, len - 2, max, &val);
+    else if (len >= 2 && str[0] == '0')
+        status = parse_oct_digits(str + 1, len - 1, max, &val);
+    else
+        status = parse_dec_digits(str, len, max, &val);
+
+    if (status != NUM_OK)
+        return status;
+
+    *out = (int32_t)(uint32_t)(negative ? -val : val);
+    return NUM_OK;
+}
+
+num_status_t parse_uint_dec(const char* str, size_t len, uint32_t max, uint32_t* out)
+{
+    uint64_t val;
+    num_status_t status = parse_dec_digits(str, len, max, &val);
+    if (status != NUM_OK)
+        return status;
+
+    *out = (uint32_t)val;
+    return NUM_OK;
+}
+
+/*
+ Float parsing : Clinger's fast path when the mantissa and the power of ten are both exact in a float,
+ Eisel-Lemire otherwise, and strtof on a normalized copy of the digits when there are too many
+ significant digits to decide the rounding.
+ See Daniel Lemire, "Number Parsing at a Gigabyte per Second" (2021).
+*/
+
+#define F32_MANTISSA_BITS   23
+#define F32_MIN_EXPONENT    (-127)
+#define F32_INFINITE_POWER  0xFF
+#define F32_SMALLEST_POW10  (-64)
+#define F32_LARGEST_POW10   38
+#define F32_MIN_EXP_ROUND_TO_EVEN (-17)
+#define F32_MAX_EXP_ROUND_TO_EVEN 10
+
+// 128-bit approximations of 5^q, normalized so that the most significant bit is set
+static const uint64_t power_of_five_128[F32_LARGEST_POW10 - F32_SMALLEST_POW10 + 1][2] =
+{
+    {0xa87fea27a539e9a5, 0x3f2398d747b36224}, // 5^-64
+    {0xd29fe4b18e88640e, 0x8eec7f0d19a03aad}, // 5^-63
+    {0x83a3eeeef9153e89, 0x1953cf68300424ac}, // 5^-62
+    {0xa48ceaaab75a8e2b, 0x5fa8c3423c052dd7}, // 5^-61
+    {0xcdb02555653131b6, 0x3792f412cb06794d}, // 5^-60
+    {0x808e17555f3ebf11, 0xe2bbd88bbee40bd0}, // 5^-59
+    {0xa0b19d2ab70e6ed6, 0x5b6aceaeae9d0ec4}, // 5^-58
+    {0xc8de047564d20a8b, 0xf245825a5a445275}, // 5^-57
+    {0xfb158592be068d2e, 0xeed6e2f0f0d56712}, // 5^-56
+    {0x9ced737bb6c4183d, 0x55464dd69685606b}, // 5^-55
+    {0xc428d05aa4751e4c, 0xaa97e14c3c26b886}, // 5^-54
+    {0xf53304714d9265df, 0xd53dd99f4b3066a8}, // 5^-53
+    {0x993fe2c6d07b7fab, 0xe546a8038efe4029}, // 5^-52
+    {0xbf8fdb78849a5f96, 0xde98520472bdd033}, // 5^-51
+    {0xef73d256a5c0f77c, 0x963e66858f6d4440}, // 5^-50
+    {0x95a8637627989aad, 0xdde7001379a44aa8}, // 5^-49
+    {0xbb127c53b17ec159, 0x5560c018580d5d52}, // 5^-48
+    {0xe9d71b689dde71af, 0xaab8f01e6e10b4a6}, // 5^-47
+    {0x9226712162ab070d, 0xcab3961304ca70e8}, // 5^-46
+    {0xb6b00d69bb55c8d1, 0x3d607b97c5fd0d22}, // 5^-45
+    {0xe45c10c42a2b3b05, 0x8cb89a7db77c506a}, // 5^-44
+    {0x8eb98a7a9a5b04e3, 0x77f3608e92adb242}, // 5^-43
+    {0xb267ed1940f1c61c, 0x55f038b237591ed3}, // 5^-42
+    {0xdf01e85f912e37a3, 0x6b6c46dec52f6688}, // 5^-41
+    {0x8b61313bbabce2c6, 0x2323ac4b3b3da015}, // 5^-40
+    {0xae397d8aa96c1b77, 0xabec975e0a0d081a}, // 5^-39
+    {0xd9c7dced53c72255, 0x96e7bd358c904a21}, // 5^-38
+    {0x881cea14545c7575, 0x7e50d64177da2e54}, // 5^-37
+    {0xaa242499697392d2, 0xdde50bd1d5d0b9e9}, // 5^-36
+    {0xd4ad2dbfc3d07787, 0x955e4ec64b44e864}, // 5^-35
+    {0x84ec3c97da624ab4, 0xbd5af13bef0b113e}, // 5^-34
+    {0xa6274bbdd0fadd61, 0xecb1ad8aeacdd58e}, // 5^-33
+    {0xcfb11ead453994ba, 0x67de18eda5814af2}, // 5^-32
+    {0x81ceb32c4b43fcf4, 0x80eacf948770ced7}, // 5^-31
+    {0xa2425ff75e14fc31, 0xa1258379a94d028d}, // 5^-30
+    {0xcad2f7f5359a3b3e, 0x096ee45813a04330}, // 5^-29
+    {0xfd87b5f28300ca0d, 0x8bca9d6e188853fc}, // 5^-28
+    {0x9e74d1b791e07e48, 0x775ea264cf55347e}, // 5^-27
+    {0xc612062576589dda, 0x95364afe032a819e}, // 5^-26
+    {0xf79687aed3eec551, 0x3a83ddbd83f52205}, // 5^-25
+    {0x9abe14cd44753b52, 0xc4926a9672793543}, // 5^-24
+    {0xc16d9a0095928a27, 0x75b7053c0f178294}, // 5^-23
+    {0xf1c90080baf72cb1, 0x5324c68b12dd6339}, // 5^-22
+    {0x971da05074da7bee, 0xd3f6fc16ebca5e04}, // 5^-21
+    {0xbce5086492111aea, 0x88f4bb1ca6bcf585}, // 5^-20
+    {0xec1e4a7db69561a5, 0x2b31e9e3d06c32e6}, // 5^-19
+    {0x9392ee8e921d5d07, 0x3aff322e62439fd0}, // 5^-18
+    {0xb877aa3236a4b449, 0x09befeb9fad487c3}, // 5^-17
+    {0xe69594bec44de15b, 0x4c2ebe687989a9b4}, // 5^-16
+    {0x901d7cf73ab0acd9, 0x0f9d37014bf60a11}, // 5^-15
+    {0xb424dc35095cd80f, 0x538484c19ef38c95}, // 5^-14
+    {0xe12e13424bb40e13, 0x2865a5f206b06fba}, // 5^-13
+    {0x8cbccc096f5088cb, 0xf93f87b7442e45d4}, // 5^-12
+    {0xafebff0bcb24aafe, 0xf78f69a51539d749}, // 5^-11
+    {0xdbe6fecebdedd5be, 0xb573440e5a884d1c}, // 5^-10
+    {0x89705f4136b4a597, 0x31680a88f8953031}, // 5^-9
+    {0xabcc77118461cefc, 0xfdc20d2b36ba7c3e}, // 5^-8
+    {0xd6bf94d5e57a42bc, 0x3d32907604691b4d}, // 5^-7
+    {0x8637bd05af6c69b5, 0xa63f9a49c2c1b110}, // 5^-6
+    {0xa7c5ac471b478423, 0x0fcf80dc33721d54}, // 5^-5
+    {0xd1b71758e219652b, 0xd3c36113404ea4a9}, // 5^-4
+    {0x83126e978d4fdf3b, 0x645a1cac083126ea}, // 5^-3
+    {0xa3d70a3d70a3d70a, 0x3d70a3d70a3d70a4}, // 5^-2
+    {0xcccccccccccccccc, 0xcccccccccccccccd}, // 5^-1
+    {0x8000000000000000, 0x0000000000000000}, // 5^0
+    {0xa000000000000000, 0x0000000000000000}, // 5^1
+    {0xc800000000000000, 0x0000000000000000}, // 5^2
+    {0xfa00000000000000, 0x0000000000000000}, // 5^3
+    {0x9c40000000000000, 0x0000000000000000}, // 5^4
+    {0xc350000000000000, 0x0000000000000000}, // 5^5
+    {0xf424000000000000, 0x0000000000000000}, // 5^6
+    {0x9896800000000000, 0x0000000000000000}, // 5^7
+    {0xbebc200000000000, 0x0000000000000000}, // 5^8
+    {0xee6b280000000000, 0x0000000000000000}, // 5^9
+    {0x9502f90000000000, 0x0000000000000000}, // 5^10
+    {0xba43b74000000000, 0x0000000000000000}, // 5^11
+    {0xe8d4a51000000000, 0x0000000000000000}, // 5^12
+    {0x9184e72a00000000, 0x0000000000000000}, // 5^13
+    {0xb5e620f480000000, 0x0000000000000000}, // 5^14
+    {0xe35fa931a0000000, 0x0000000000000000}, // 5^15
+    {0x8e1bc9bf04000000, 0x0000000000000000}, // 5^16
+    {0xb1a2bc2ec5000000, 0x0000000000000000}, // 5^17
+    {0xde0b6b3a76400000, 0x0000000000000000}, // 5^18
+    {0x8ac7230489e80000, 0x0000000000000000}, // 5^19
+    {0xad78ebc5ac620000, 0x0000000000000000}, // 5^20
+    {0xd8d726b7177a8000, 0x0000000000000000}, // 5^21
+    {0x878678326eac9000, 0x0000000000000000}, // 5^22
+    {0xa968163f0a57b400, 0x0000000000000000}, // 5^23
+    {0xd3c21bcecceda100, 0x0000000000000000}, // 5^24
+    {0x84595161401484a0, 0x0000000000000000}, // 5^25
+    {0xa56fa5b99019a5c8, 0x0000000000000000}, // 5^26
+    {0xcecb8f27f4200f3a, 0x0000000000000000}, // 5^27
+    {0x813f3978f8940984, 0x4000000000000000}, // 5^28
+    {0xa18f07d736b90be5, 0x5000000000000000}, // 5^29
+    {0xc9f2c9cd04674ede, 0xa400000000000000}, // 5^30
+    {0xfc6f7c4045812296, 0x4d00000000000000}, // 5^31
+    {0x9dc5ada82b70b59d, 0xf020000000000000}, // 5^32
+    {0xc5371912364ce305, 0x6c28000000000000}, // 5^33
+    {0xf684df56c3e01bc6, 0xc732000000000000}, // 5^34
+    {0x9a130b963a6c115c, 0x3c7f400000000000}, // 5^35
+    {0xc097ce7bc90715b3, 0x4b9f100000000000}, // 5^36
+    {0xf0bdc21abb48db20, 0x1e86d40000000000}, // 5^37
+    {0x96769950b50d88f4, 0x1314448000000000}, // 5^38
+};
+
+static const float exact_pow10f[] =
+{
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+
+typedef struct adjusted_mantissa_t
+{
+    uint64_t mantissa;
+    int32_t power2;
+} adjusted_mantissa_t;
+
+// w * 10^q, w != 0
+static adjusted_mantissa_t compute_float32(int64_t q, uint64_t w)
+{
+    adjusted_mantissa_t answer;
+    if (w == 0 || q < F32_SMALLEST_POW10)
+    {
+        answer.mantissa = 0;
+        answer.power2 = 0;
+        return answer;
+    }
+    if (q > F32_LARGEST_POW10)
+    {
+        answer.mantissa = 0;
+        answer.power2 = F32_INFINITE_POWER;
+        return answer;
+    }
+
+    int lz = __builtin_clzll(w);
+    w <<= lz;
+
+    // we only need the 26 most significant bits of the product to be exact
+    const uint64_t* pow5 = power_of_five_128[q - F32_SMALLEST_POW10];
+    unsigned __int128 product = (unsigned __int128)w * pow5[0];
+    uint64_t high = (uint64_t)(product >> 64);
+    uint64_t low  = (uint64_t)product;
+    const uint64_t precision_mask = UINT64_MAX >> (F32_MANTISSA_BITS + 3);
+    if ((high & precision_mask) == precision_mask)
+    {
+        uint64_t second_high = (uint64_t)(((unsigned __int128)w * pow5[1]) >> 64);
+        low += second_high;
+        if (second_high > low)
+            ++high;
+    }
+
+    int upperbit = (int)(high >> 63);
+    int shift = upperbit + 64 - F32_MANTISSA_BITS - 3;
+    answer.mantissa = high >> shift;
+    // floor(q * log2(10)) + 63
+    int32_t power = (int32_t)(((152170 + 65536) * (int32_t)q) >> 16) + 63;
+    answer.power2 = power + upperbit - lz - F32_MIN_EXPONENT;
+
+    if (answer.power2 <= 0) // subnormal
+    {
+        if (-answer.power2 + 1 >= 64)
+        {
+            answer.mantissa = 0;
+            answer.power2 = 0;
+            return answer;
+        }
+        answer.mantissa >>= -answer.power2 + 1;
+        answer.mantissa += (answer.mantissa & 1);
+        answer.mantissa >>= 1;
+        answer.power2 = (answer.mantissa < ((uint64_t)1 << F32_MANTISSA_BITS)) ? 0 : 1;
+        return answer;
+    }
+
+    // exactly halfway between two floats : round to even
+    if (low <= 1 && q >= F32_MIN_EXP_ROUND_TO_EVEN && q <= F32_MAX_EXP_ROUND_TO_EVEN
+        && (answer.mantissa & 3) == 1)
+    {
+        if ((answer.mantissa << shift) == high)
+            answer.mantissa &= ~(uint64_t)1;
+    }
+
+    answer.mantissa += (answer.mantissa & 1);
+    answer.mantissa >>= 1;
+    if (answer.mantissa >= ((uint64_t)2 << F32_MANTISSA_BITS))
+    {
+        answer.mantissa = (uint64_t)1 << F32_MANTISSA_BITS;
+        ++answer.power2;
+    }
+    answer.mantissa &= ~((uint64_t)1 << F32_MANTISSA_BITS);
+    if (answer.power2 >= F32_INFINITE_POWER)
+    {
+        answer.power2 = F32_INFINITE_POWER;
+        answer.mantissa = 0;
+    }
+
+    return answer;
+}
+
+static float make_float32(int negative, adjusted_mantissa_t am)
+{
+    uint32_t bits = (uint32_t)am.mantissa | ((uint32_t)am.power2 << F32_MANTISSA_BITS) | ((uint32_t)negative << 31);
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+static int match_word(const char* str, size_t len, const char* word)
+{
+    size_t word_len = strlen(word);
+    if (len != word_len)
+        return 0;
+    for (size_t i = 0; i < len; ++i)
+        if ((str[i] | 0x20) != word[i])
+            return 0;
+    return 1;
+}
+
+// strtof on a NUL-terminated copy. Only used for hexadecimal floats and for the rare numbers whose
+// rounding can't be decided from their first 19 digits. Decimal input is rewritten as '<digits>e<exp>',
+// which doesn't contain a radix character, so the current locale doesn't matter.
+// same range checks as the fast path : strtof also reports ERANGE for inexact subnormals, which are kept
+static num_status_t strtof_status(float value, int error)
+{
+    if (error != ERANGE)
+        return NUM_OK;
+    if (__builtin_isinf(value))
+        return NUM_OVERFLOW;
+    if (value == 0.0f)
+        return NUM_UNDERFLOW;
+    return NUM_OK;
+}
+
+static num_status_t parse_float_fallback(int negative, const char* digits, size_t digit_count,
+                                         const char* frac, size_t frac_count, int64_t exponent, float* out)
+{
+    char local_buf[128];
+    size_t needed = 1 + digit_count + frac_count + 32;
+    char* buf = needed <= sizeof(local_buf) ? local_buf : malloc(needed);
+
+    char* ptr = buf;
+    if (negative)
+        *ptr++ = '-';
+    memcpy(ptr, digits, digit_count); ptr += digit_count;
+    memcpy(ptr, frac, frac_count);    ptr += frac_count;
+    sprintf(ptr, "e%lld", (long long)(exponent - (int64_t)frac_count));
+
+    errno = 0;
+    *out = strtof(buf, NULL);
+    num_status_t status = strtof_status(*out, errno);
+
+    if (buf != local_buf)
+        free(buf);
+
+    return status;
+}
+
+num_status_t parse_float32(const char* str, size_t len, float* out)
+{
+    const char* ptr = str;
+    const char* end = str + len;
+
+    int negative = 0;
+    if (ptr != end && (*ptr == '-' || *ptr == '+'))
+    {
+        negative = *ptr == '-';
+        ++ptr;
+    }
+    if (ptr == end)
+        return NUM_EMPTY;
+
+    if (match_word(ptr, end - ptr, "inf") || match_word(ptr, end - ptr, "infinity"))
+    {
+        *out = negative ? -__builtin_inff() : __builtin_inff();
+        return NUM_OK;
+    }
+    if (match_word(ptr, end - ptr, "nan"))
+    {
+        *out = negative ? -__builtin_nanf("") : __builtin_nanf("");
+        return NUM_OK;
+    }
+
+    if (end - ptr >= 2 && ptr[0] == '0' && (ptr[1] | 0x20) == 'x')
+    {
+        // hexadecimal floats are exact, leave them to the C library
+        char local_buf[128];
+        if (len >= sizeof(local_buf))
+            return NUM_OVERFLOW;
+        memcpy(local_buf, str, len);
+        local_buf[len] = '\0';
+        char* endptr;
+        errno = 0;
+        *out = strtof(local_buf, &endptr);
+        if ((size_t)(endptr - local_buf) != len)
+            return NUM_INVALID;
+        return strtof_status(*out, errno);
+    }
+
+    // integer part
+    const char* int_start = ptr;
+    while (end - ptr >= 8 && swar_is_8_digits(load_u64(ptr)))
+        ptr += 8;
+    while (ptr != end && (unsigned)(*ptr - '0') <= 9)
+        ++ptr;
+    const char* int_end = ptr;
+
+    // fractional part
+    const char* frac_start = ptr;
+    const char* frac_end = ptr;
+    if (ptr != end && *ptr == '.')
+    {
+        frac_start = ++ptr;
+        while (end - ptr >= 8 && swar_is_8_digits(load_u64(ptr)))
+            ptr += 8;
+        while (ptr != end && (unsigned)(*ptr - '0') <= 9)
+            ++ptr;
+        frac_end = ptr;
+    }
+
+    if (int_start == int_end && frac_start == frac_end)
+        return (ptr == end) ? NUM_EMPTY : NUM_INVALID;
+
+    // exponent
+    int64_t exponent = 0;
+    if (ptr != end && (*ptr | 0x20) == 'e')
+    {
+        ++ptr;
+        int exp_negative = 0;
+        if (ptr != end && (*ptr == '-' || *ptr == '+'))
+        {
+            exp_negative = *ptr == '-';
+            ++ptr;
+        }
+        if (ptr == end)
+            return NUM_EMPTY;
+        for (; ptr != end; ++ptr)
+        {
+            unsigned digit = (unsigned char)*ptr - '0';
+            if (digit > 9)
+                return NUM_INVALID;
+            if (exponent < 0x10000000) // anything that large is either zero or infinity anyway
+                exponent = exponent*10 + digit;
+        }
+        if (exp_negative)
+            exponent = -exponent;
+    }
+
+    if (ptr != end)
+        return NUM_INVALID;
+
+    // gather at most 19 significant digits
+    uint64_t w = 0;
+    int digits = 0;
+    int truncated = 0;
+    int64_t q = exponent;
+    const char* p = int_start;
+    while (p != int_end && *p == '0')
+        ++p;
+    for (; p != int_end; ++p)
+    {
+        if (digits < 19)
+        {
+            w = w*10 + (*p - '0');
+            ++digits;
+        }
+        else
+        {
+            truncated |= (*p != '0');
+            ++q;
+        }
+    }
+    p = frac_start;
+    if (digits == 0)
+        while (p != frac_end && *p == '0')
+        {
+            ++p;
+            --q;
+        }
+    while (p != frac_end && digits < 19)
+    {
+        if (digits <= 11 && frac_end - p >= 8)
+        {
+            w = w*100000000 + swar_parse_8_digits(load_u64(p));
+            digits += 8;
+            p += 8;
+            q -= 8;
+            continue;
+        }
+        w = w*10 + (*p++ - '0');
+        ++digits;
+        --q;
+    }
+    for (; p != frac_end; ++p)
+        truncated |= (*p != '0');
+
+    if (w == 0)
+    {
+        *out = negative ? -0.0f : 0.0f;
+        return NUM_OK;
+    }
+
+    // Clinger's fast path : both w and 10^|q| are exactly representable
+    if (!truncated && q >= -10 && q <= 10 && w <= ((uint64_t)1 << (F32_MANTISSA_BITS + 1)))
+    {
+        float value = (float)w;
+        if (q < 0)
+            value /= exact_pow10f[-q];
+        else
+            value *= exact_pow10f[q];
+        *out = negative ? -value : value;
+        return NUM_OK;
+    }
+
+    adjusted_mantissa_t am = compute_float32(q, w);
+    if (truncated)
+    {
+        // the exact value lies between w and w+1, it's only decided if both round the same way
+        adjusted_mantissa_t am_up = compute_float32(q, w + 1);
+        if (am.mantissa != am_up.mantissa || am.power2 != am_up.power2)
+            return parse_float_fallback(negative, int_start, int_end - int_start,
+                                        frac_start, frac_end - frac_start, exponent, out);
+    }
+
+    if (am.power2 == F32_INFINITE_POWER)
+        return NUM_OVERFLOW;
+    if (am.power2 == 0 && am.mantissa == 0)
+        return NUM_UNDERFLOW;
+
+    *out = make_float32(negative, am);
+    return NUM_OK;
+}
+
+const char* num_status_str(num_status_t status)
+{
+    switch (status)
+    {
+        case NUM_OK:
+            return "ok";
+        case NUM_EMPTY:
+            return "missing digits";
+        case NUM_INVALID:
+            return "invalid character in number";
+        case NUM_OVERFLOW:
+            return "number out of range";
+        case NUM_UNDERFLOW:
+            return "number too small, rounds to zero";
+    }
+
+    return "unknown error";
+}
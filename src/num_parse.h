@@ -0,0 +1,30 @@
+#ifndef NUM_PARSE_H_INCLUDED
+#define NUM_PARSE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Length-bounded, locale-independent number parsers.
+// The input doesn't need to be NUL-terminated, and the whole span must be consumed.
+
+typedef enum num_status_t
+{
+    NUM_OK = 0,
+    NUM_EMPTY,    // no digits at all
+    NUM_INVALID,  // unexpected character in the span
+    NUM_OVERFLOW, // value doesn't fit in the destination type
+    NUM_UNDERFLOW // non-zero value that rounds to zero (floats only, subnormals are accepted)
+} num_status_t;
+
+// accepts decimal, '0x' hexadecimal and '0' octal (like strtol with base 0)
+// values in [-2^31, 2^32-1] are accepted, values above INT32_MAX wrap around
+num_status_t parse_int32(const char* str, size_t len, int32_t* out);
+// unsigned decimal only, value must be <= max
+num_status_t parse_uint_dec(const char* str, size_t len, uint32_t max, uint32_t* out);
+// correctly rounded decimal to binary32 conversion, values rounding to infinity are NUM_OVERFLOW
+// (but "inf" itself is accepted)
+num_status_t parse_float32(const char* str, size_t len, float* out);
+
+const char* num_status_str(num_status_t status);
+
+#endif // NUM_PARSE_H_INCLUDED
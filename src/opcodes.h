@@ -0,0 +1,132 @@
+#ifndef OPCODES_H_INCLUDED
+#define OPCODES_H_INCLUDED
+
+#include <stdint.h>
+
+// X(name, opbyte, operand kind), the operand kind matches the DECLARE_* encoder used for the instruction
+#define FOREACH_INSTRUCTION(X) \
+    X(brk,       0xFF, 0OP) \
+    X(chknotnul, 0xF1, 0OP) \
+    X(isnull,    0xF2, 0OP) \
+    X(strlen,    0x20, 0OP) \
+    X(strcat,    0x21, 0OP) \
+    X(stradd,    0x22, 0OP) \
+    X(streq,     0x23, 0OP) \
+    X(pushk,     0x24, 1OP_B_IMM) \
+    X(pushkw,    0x25, 1OP_VAR) \
+    X(nop,       0x90, 0OP) \
+    X(add,       0xA0, 0OP) \
+    X(sub,       0xA1, 0OP) \
+    X(mul,       0xA2, 0OP) \
+    X(idiv,      0xA3, 0OP) \
+    X(mod,       0xA4, 0OP) \
+    X(inc,       0xA5, 0OP) \
+    X(dec,       0xA6, 0OP) \
+    X(incl,      0xA7, 1OP_VAR) \
+    X(decl,      0xA8, 1OP_VAR) \
+    X(shl,       0xA9, 0OP) \
+    X(shr,       0xAA, 0OP) \
+    X(ret,       0xB0, 0OP) \
+    X(cvtf2i,    0xC0, 0OP) \
+    X(cvti2f,    0xC1, 0OP) \
+    X(cvti2s,    0xC2, 0OP) \
+    X(cvtf2s,    0xC3, 0OP) \
+    X(calli,     0x34, 0OP) \
+    X(eq,        0xE0, 0OP) \
+    X(neq,       0xE1, 0OP) \
+    X(lt,        0xE2, 0OP) \
+    X(land,      0xE6, 0OP) \
+    X(lor,       0xE7, 0OP) \
+    X(lnot,      0xE8, 0OP) \
+    X(feq,       0xE9, 0OP) \
+    X(alloc,     0xD0, 0OP) \
+    X(copy,      0xD1, 0OP) \
+    X(load,      0xD2, 0OP) \
+    X(store,     0xD3, 0OP) \
+    X(memsize,   0xD4, 0OP) \
+    X(memresize, 0xD5, 0OP) \
+    X(arraycat,  0xD6, 0OP) \
+    X(find,      0xD8, 0OP) \
+    X(findi,     0xD9, 0OP) \
+    X(mkrange,   0xDA, 0OP) \
+    X(randi,     0x40, 0OP) \
+    X(randf,     0x41, 0OP) \
+    X(randa,     0x42, 0OP) \
+    X(pow,       0x43, 0OP) \
+    X(ln,        0x44, 0OP) \
+    X(log10,     0x45, 0OP) \
+    X(exp,       0x46, 0OP) \
+    X(sqrt,      0x47, 0OP) \
+    X(abs,       0x48, 0OP) \
+    X(fabs,      0x49, 0OP) \
+    X(ceil,      0x4A, 0OP) \
+    X(floor,     0x4B, 0OP) \
+    X(rad2deg,   0x4C, 0OP) \
+    X(deg2rad,   0x4D, 0OP) \
+    X(eql,       0x60, 1OP_VAR) \
+    X(neql,      0x61, 1OP_VAR) \
+    X(ltl,       0x62, 1OP_VAR) \
+    X(cos,       0x50, 0OP) \
+    X(sin,       0x51, 0OP) \
+    X(tan,       0x52, 0OP) \
+    X(acos,      0x53, 0OP) \
+    X(asin,      0x54, 0OP) \
+    X(atan,      0x55, 0OP) \
+    X(atan2,     0x56, 0OP) \
+    X(pop,       0x10, 0OP) \
+    X(pushi,     0x11, 1OP_I_IMM) \
+    X(stackcpy,  0xD7, 1OP_I_IMM) \
+    X(pushf,     0x12, 1OP_F_IMM) \
+    X(syscall,   0xF0, 1OP_I_IMM) \
+    X(pushs,     0x13, 1OP_VAR) \
+    X(pushl,     0x14, 1OP_VAR) \
+    X(pushg,     0x15, 1OP_VAR) \
+    X(movl,      0x16, 1OP_VAR) \
+    X(movg,      0x17, 1OP_VAR) \
+    X(copyl,     0x18, 1OP_VAR) \
+    X(dup,       0x19, 0OP) \
+    X(getaddrl,  0x1A, 1OP_VAR) \
+    X(getaddrg,  0x1B, 1OP_VAR) \
+    X(cmov,      0x1C, 0OP) \
+    X(pushnull,  0x1D, 0OP) \
+    X(pushib,    0x1E, 1OP_B_IMM) \
+    X(pusha,     0x1F, 1OP_I_IMM) \
+    X(jt,        0x30, 1OP_LBL) \
+    X(jf,        0x31, 1OP_LBL) \
+    X(jmp,       0x32, 1OP_LBL) \
+    X(call,      0x33, 1OP_LBL) \
+    X(jmpt,      0x35, 1OP_TBL) \
+    X(loadt,     0x36, 1OP_TBL)
+
+typedef enum opcode_t
+{
+#define X(name, opbyte, kind) OP_##name = opbyte,
+    FOREACH_INSTRUCTION(X)
+#undef X
+} opcode_t;
+
+typedef enum operand_kind_t
+{
+    OPERAND_NONE = 0, // not a valid opcode
+    OPERAND_0OP,
+    OPERAND_1OP_I_IMM, // 32-bit integer immediate, or a label address
+    OPERAND_1OP_F_IMM, // 32-bit float immediate
+    OPERAND_1OP_B_IMM, // 8-bit integer immediate
+    OPERAND_1OP_VAR,   // 16-bit variable index
+    OPERAND_1OP_LBL,   // 32-bit code address
+    OPERAND_1OP_TBL    // 16-bit jump table index, written as the table name (see jump_table.h)
+} operand_kind_t;
+
+typedef struct opcode_info_t
+{
+    const char* name;
+    operand_kind_t kind;
+} opcode_info_t;
+
+// indexed by opbyte, unused entries have a NULL name
+extern const opcode_info_t opcode_infos[256];
+
+// size of the operand following the opcode byte
+int operand_size(operand_kind_t kind);
+
+#endif // OPCODES_H_INCLUDED
@@ -0,0 +1,26 @@
+#ifndef OPTIONS_H_INCLUDED
+#define OPTIONS_H_INCLUDED
+
+// part of the output cache key, bump it whenever the same source and options would assemble differently
+#define ASSEMBLER_VERSION "1.5"
+
+typedef enum output_format_t
+{
+    OUTPUT_DNPX,
+    OUTPUT_ELF, // relocatable object, see embed.h
+    OUTPUT_C    // C source array, see embed.h
+} output_format_t;
+
+typedef struct asm_options_t
+{
+    int optimize_cfg; // -O
+    int frame_info;   // --frame-info : stack depth analysis, emitted as a "FRAM" image section
+    int pic;          // --pic : position-independent code, see pic.h
+    int const_pool;   // --const-pool : repeated immediates in a "KPOL" section, see const_pool.h
+    int inline_size;  // --inline, --inline-size : largest leaf function inlined, in instructions, 0 to disable
+    int register_code;// --register-code : register bytecode translation in a "RCOD" section, see regcode.h
+    output_format_t output_format; // --format
+    const char* symbol_name;       // --symbol-name, prefix of the exported symbols for OUTPUT_ELF and OUTPUT_C
+} asm_options_t;
+
+#endif // OPTIONS_H_INCLUDED
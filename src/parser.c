@@ -4,40 +4,59 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
+#include "builder.h"
+#include "fatal.h"
+#include "hash.h"
 #include "hash_table.h"
 #include "instructions.h"
+#include "jump_table.h"
+#include "num_parse.h"
+#include "token.h"
 
-static const char* source_ptr;
-static const char* start_of_line;
-static int current_line = 1;
+// per thread, so that several units can be parsed in parallel
+static _Thread_local const char* source_ptr;
+static _Thread_local const char* start_of_line;
+static _Thread_local int current_line = 1;
 
 uint8_t buffer[4096];
 
-const char* parse_label()
+static void make_token(const char* start, const char* end, token_t* tok)
+{
+    char* str = malloc(end - start + 1);
+    memcpy(str, start, end - start);
+    str[end - start] = '\0';
+
+    tok->str = str;
+    tok->len = end - start;
+    tok->hash = mem_hash(start, end - start);
+}
+
+int parse_label(token_t* label)
 {
     const char* start = source_ptr;
     while (isalnum(*source_ptr) || *source_ptr == '.' || *source_ptr == '_')
         ++source_ptr;
     if (*source_ptr == ':') // it's a label !
     {
-        char* label_str = malloc(source_ptr - start + 1);
-        memcpy(label_str, start, source_ptr - start);
-        label_str[source_ptr - start] = '\0';
+        make_token(start, source_ptr, label);
 
         ++source_ptr;
 
-        return label_str;
+        return 1;
     }
     else
     {
         // revert
         source_ptr = start;
-        return NULL;
+        return 0;
     }
 }
 
-const char* parse_opcode()
+void parse_opcode(token_t* opcode)
 {
     const char* start = source_ptr;
 
@@ -46,17 +65,13 @@ const char* parse_opcode()
 
     if (start == source_ptr) // no opcode
     {
-        abort();
+        asm_fatal();
     }
 
-    char* opcode_str = malloc(source_ptr - start + 1);
-    memcpy(opcode_str, start, source_ptr - start);
-    opcode_str[source_ptr - start] = '\0';
-
-    return opcode_str;
+    make_token(start, source_ptr, opcode);
 }
 
-const char* parse_operand()
+int parse_operand(token_t* operand)
 {
     const char* start = source_ptr;
 
@@ -66,14 +81,12 @@ const char* parse_operand()
 
     if (start == source_ptr) // no opcode
     {
-        return NULL;
+        return 0;
     }
 
-    char* operand_str = malloc(source_ptr - start + 1);
-    memcpy(operand_str, start, source_ptr - start);
-    operand_str[source_ptr - start] = '\0';
+    make_token(start, source_ptr, operand);
 
-    return operand_str;
+    return 1;
 }
 
 void consume_whitespace()
@@ -93,71 +106,94 @@ void consume_comments()
         ++source_ptr;
 }
 
-// assumes we've already consumed the first '"'
-const char* end_of_string_lit(const char* str)
+#ifdef __SSE2__
+// Aligned 16 byte loads never cross a page boundary, so reading past the terminating NUL is harmless,
+// but it isn't visible to the sanitizers.
+__attribute__((no_sanitize_address))
+static const char* find_literal_special(const char* ptr)
 {
-    while (*str)
+    const __m128i quote     = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i zero      = _mm_setzero_si128();
+
+    size_t misalign = (uintptr_t)ptr & 15;
+    const __m128i* block = (const __m128i*)(ptr - misalign);
+    for (unsigned ignored = misalign;; ++block, ignored = 0)
     {
-        if (str[0] == '"' && str[-1] != '\\')
-            return str;
-        ++str;
+        __m128i bytes = _mm_load_si128(block);
+        __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, quote), _mm_cmpeq_epi8(bytes, backslash)),
+                                       _mm_cmpeq_epi8(bytes, zero));
+        unsigned mask = (unsigned)_mm_movemask_epi8(special) >> ignored << ignored;
+        if (mask)
+            return (const char*)block + __builtin_ctz(mask);
     }
-
-    return NULL;
 }
+#else
+static const char* find_literal_special(const char* ptr)
+{
+    while (*ptr && *ptr != '"' && *ptr != '\\')
+        ++ptr;
+    return ptr;
+}
+#endif
 
-const char* parse_string_literal(const char* ptr, char** buf_ptr, int* len)
+// Decodes the literal in a single pass : plain runs between a '"', '\\' or NUL are found 16 bytes at a time and
+// copied in bulk, escapes are handled inline.
+// The result is NUL-terminated and allocated in 'pool', returns the character after the closing quote or NULL.
+const char* parse_string_literal(const char* ptr, string_pool_t* pool, char** buf_ptr, int* len)
 {
     if (*ptr != '"')
         return NULL;
-
     ++ptr;
-    const char* literal_start = ptr;
-    const char* literal_end   = end_of_string_lit(ptr);
-    if (literal_end == NULL)
-        return NULL;
-    int literal_len = literal_end - literal_start;
 
-    char* loc_buf_ptr = (char*)malloc(literal_len+1);
-    *buf_ptr = loc_buf_ptr;
-    fprintf(stderr, "parsing literal '%s'\n", literal_start);
+    size_t capacity = 64;
+    size_t size = 0;
+    char* out = string_pool_reserve(pool, capacity);
 
-    for (int i = 0; i < literal_len; ++i)
+    for (;;)
     {
-        // escape
-        if (literal_start[i] == '\\')
+        const char* special = find_literal_special(ptr);
+        size_t run = special - ptr;
+        // room for the run, one escaped character and the terminator
+        if (size + run + 2 > capacity)
         {
-            ++i;
-            if (i == literal_len)
-                abort();
-
-            switch (literal_start[i])
-            {
-                case 'n':
-                    *loc_buf_ptr++ = '\n';
-                    break;
-                case '\\':
-                    *loc_buf_ptr++ = '\\';
-                    break;
-                case '"':
-                    *loc_buf_ptr++ = '"';
-                    break;
-                default:
-                    fprintf(stderr, "unrecognized escape character : '%c'\n", literal_start[i]);
-            }
+            while (size + run + 2 > capacity)
+                capacity *= 2;
+            out = string_pool_grow(pool, out, size, capacity);
         }
-        else
+        memcpy(out + size, ptr, run);
+        size += run;
+        ptr = special;
+
+        if (*ptr == '"')
+            break;
+        if (*ptr == '\0' || ptr[1] == '\0')
+            return NULL;
+
+        ++ptr;
+        switch (*ptr)
         {
-            *loc_buf_ptr++ = literal_start[i];
+            case 'n':
+                out[size++] = '\n';
+                break;
+            case '\\':
+                out[size++] = '\\';
+                break;
+            case '"':
+                out[size++] = '"';
+                break;
+            default:
+                fprintf(stderr, "unrecognized escape character : '%c'\n", *ptr);
         }
+        ++ptr;
     }
-    *loc_buf_ptr = '\0';
+    out[size] = '\0';
+    string_pool_commit(pool, size + 1);
 
-    ptr = literal_end + 1;
+    *buf_ptr = out;
+    *len = size;
 
-    *len = loc_buf_ptr - *buf_ptr;
-
-    return ptr;
+    return ptr + 1;
 }
 
 void parse_string_directive(asm_unit_t* unit)
@@ -165,25 +201,28 @@ void parse_string_directive(asm_unit_t* unit)
     source_ptr += 7; // skip ".string"
     consume_whitespace();
 
-    char* endptr;
-    errno = 0;
-    int string_id = strtol(source_ptr, &endptr, 0);
-    if (endptr == source_ptr)
-        abort();
-    if (errno != 0)
-        abort();
-    source_ptr = endptr;
+    const char* id_start = source_ptr;
+    while (isalnum(*source_ptr) || *source_ptr == '-' || *source_ptr == '+')
+        ++source_ptr;
+
+    int32_t string_id;
+    num_status_t status = parse_int32(id_start, source_ptr - id_start, &string_id);
+    if (status != NUM_OK)
+    {
+        fprintf(stderr, "line %d : invalid string id : %s\n", current_line, num_status_str(status));
+        asm_fatal();
+    }
 
     consume_whitespace();
     if (*source_ptr++ != ',')
-        abort();
+        asm_fatal();
     consume_whitespace();
 
     char* string_contents;
     int len;
-    source_ptr = parse_string_literal(source_ptr, &string_contents, &len);
+    source_ptr = parse_string_literal(source_ptr, &unit->string_pool, &string_contents, &len);
     if (source_ptr == NULL)
-        abort();
+        asm_fatal();
 
     if (len >= 0x10000)
         printf("warning : string literal is too large (length doesn't fit in 16-bit)\n");
@@ -198,6 +237,52 @@ void parse_string_directive(asm_unit_t* unit)
     DYNARRAY_ADD(unit->strings, str_entry);
 }
 
+void parse_table_directive(asm_unit_t* unit)
+{
+    source_ptr += 6; // skip ".table"
+    consume_whitespace();
+
+    token_t name;
+    if (!parse_operand(&name))
+    {
+        fprintf(stderr, "line %d : missing jump table name\n", current_line);
+        asm_fatal();
+    }
+    int table = asm_table(unit, name.str, name.hash);
+    if (unit->tables.ptr[table].defined)
+    {
+        fprintf(stderr, "line %d : jump table '%s' is already defined\n", current_line, name.str);
+        asm_fatal();
+    }
+    free((void*)name.str);
+
+    consume_whitespace();
+    while (*source_ptr == ',')
+    {
+        ++source_ptr;
+        consume_whitespace();
+
+        token_t label;
+        if (!parse_operand(&label))
+        {
+            fprintf(stderr, "line %d : missing label in jump table\n", current_line);
+            asm_fatal();
+        }
+        asm_table_add_label_name(unit, table, label.str, label.hash);
+        free((void*)label.str);
+
+        consume_whitespace();
+    }
+    consume_comments();
+
+    const jump_table_t* tbl = &unit->tables.ptr[table];
+    if (tbl->entries.size == 0 || tbl->entries.size >= 0x10000)
+    {
+        fprintf(stderr, "line %d : jump table '%s' must have between 1 and 65535 entries\n", current_line, tbl->name);
+        asm_fatal();
+    }
+}
+
 int parse_directive(asm_unit_t* unit)
 {
     if (strncmp(source_ptr, ".string", 7) == 0 && isspace(source_ptr[7]))
@@ -205,6 +290,11 @@ int parse_directive(asm_unit_t* unit)
         parse_string_directive(unit);
         return 1;
     }
+    if (strncmp(source_ptr, ".table", 6) == 0 && isspace(source_ptr[6]))
+    {
+        parse_table_directive(unit);
+        return 1;
+    }
 
     return 0;
 }
@@ -217,20 +307,31 @@ int string_list_cmp(const void* vlhs, const void* vrhs)
     return lhs->id - rhs->id;
 }
 
-void parse_file(asm_unit_t* asm_unit)
+void parse_init(asm_unit_t* asm_unit)
 {
     asm_unit->labels = mk_hash_table(1031); // prime number
     DYNARRAY_INIT(asm_unit->relocs, 256);
     DYNARRAY_INIT(asm_unit->strings, 256);
     DYNARRAY_INIT(asm_unit->object_buffer, 4096);
+    DYNARRAY_INIT(asm_unit->label_handles, 0);
+    DYNARRAY_INIT(asm_unit->sections, 0);
+    DYNARRAY_INIT(asm_unit->tables, 0);
+    string_pool_init(&asm_unit->string_pool);
+    asm_unit->code_base = 0;
+    asm_unit->pic = 0;
+    asm_unit->label_defined = NULL;
+    asm_unit->user_data = NULL;
 
-    source_ptr = start_of_line = asm_unit->source;
     current_line = 0;
+}
+
+void parse_source(asm_unit_t* asm_unit, const char* source)
+{
+    source_ptr = start_of_line = source;
 
     while (*source_ptr)
     {
-        const char* label, *opcode, *operand;
-        label = opcode = operand = NULL;
+        token_t label, opcode, operand;
         ++current_line;
         start_of_line = source_ptr;
 
@@ -247,41 +348,43 @@ void parse_file(asm_unit_t* asm_unit)
         }
         else if (!parse_directive(asm_unit)) // handle assembler directives
         {
-            while ((label = parse_label()))
+            while (parse_label(&label))
             {
-                hash_table_insert(&asm_unit->labels, label, (hash_value_t){.idx = asm_unit->object_buffer.size});
+                int addr = asm_unit->code_base + asm_unit->object_buffer.size;
+                hash_table_insert_hashed(&asm_unit->labels, label.str, label.hash, (hash_value_t){.idx = addr});
+                if (asm_unit->label_defined)
+                    asm_unit->label_defined(asm_unit, label.str, label.hash, addr);
 
                 consume_whitespace();
                 consume_comments();
-                if (*source_ptr == '\n')
-                {
-                    ++source_ptr;
-                    continue;
-                }
             }
 
-            consume_whitespace();
-
-            opcode = parse_opcode();
+            // label-only line
+            if (*source_ptr != '\n' && *source_ptr != '\0')
+            {
+                parse_opcode(&opcode);
 
-            consume_whitespace();
+                consume_whitespace();
 
-            operand = parse_operand();
+                int has_operand = parse_operand(&operand);
 
-            consume_whitespace();
+                consume_whitespace();
 
-            consume_comments();
+                consume_comments();
 
-            fprintf(stderr, "parsed %s %s\n", opcode, operand);
+                hash_value_t* val = hash_table_get_hashed(&ins_callbacks, opcode.str, opcode.hash);
+                if (!val || !val->fn_ptr)
+                {
+                    fprintf(stderr, "line %d : unknown opcode %s\n", current_line, opcode.str);
+                    asm_fatal();
+                }
+                // callback to write the instruction bytes
+                val->fn_ptr(has_operand ? &operand : NULL, asm_unit);
 
-            hash_value_t* val = hash_table_get(&ins_callbacks, opcode);
-            if (!val || !val->fn_ptr)
-            {
-                fprintf(stderr, "unknown opcode %s\n", opcode);
-                abort();
+                free((void*)opcode.str);
+                if (has_operand)
+                    free((void*)operand.str);
             }
-            // callback to write the instruction bytes
-            val->fn_ptr(operand, asm_unit);
         }
 
         if (*source_ptr == '\0')
@@ -289,24 +392,58 @@ void parse_file(asm_unit_t* asm_unit)
         if (*source_ptr != '\n') // wtf
         {
             printf("wot??\n");
-            abort();
+            asm_fatal();
         }
 
         ++source_ptr;
     }
+}
 
-    // resolve relocations
-    for (int i = 0; i < asm_unit->relocs.size; ++i)
+int reloc_target_address(asm_unit_t* asm_unit, const reloc_pair_t* reloc)
+{
+    if (reloc->target_label == NULL)
     {
-        hash_value_t* label_addr = hash_table_get(&asm_unit->labels, asm_unit->relocs.ptr[i].target_label);
-        if (!label_addr)
+        const label_handle_t* handle = &asm_unit->label_handles.ptr[reloc->target_handle];
+        if (handle->addr < 0)
         {
-            fprintf(stderr, "label '%s' not found\n", asm_unit->relocs.ptr[i].target_label);
-            abort();
+            fprintf(stderr, "label '%s' (#%d) was never bound\n", handle->name ? handle->name : "", reloc->target_handle);
+            asm_fatal();
         }
 
-        *(uint32_t*)(asm_unit->object_buffer.ptr + asm_unit->relocs.ptr[i].reloc_index) = label_addr->idx;
+        return handle->addr;
+    }
+
+    hash_value_t* label_addr = hash_table_get_hashed(&asm_unit->labels, reloc->target_label, reloc->target_hash);
+    if (!label_addr)
+    {
+        fprintf(stderr, "label '%s' not found\n", reloc->target_label);
+        asm_fatal();
+    }
+
+    return label_addr->idx;
+}
+
+void resolve_relocations(asm_unit_t* asm_unit)
+{
+    for (int i = 0; i < asm_unit->relocs.size; ++i)
+    {
+        *(uint32_t*)(asm_unit->object_buffer.ptr + asm_unit->relocs.ptr[i].reloc_index)
+                = reloc_target_address(asm_unit, &asm_unit->relocs.ptr[i]);
     }
+}
+
+void sort_strings(asm_unit_t* asm_unit)
+{
+    qsort(asm_unit->strings.ptr, asm_unit->strings.size, sizeof(string_constant_t), string_list_cmp);
+}
+
+void parse_file(asm_unit_t* asm_unit)
+{
+    parse_init(asm_unit);
+    parse_source(asm_unit, asm_unit->source);
+
+    resolve_relocations(asm_unit);
+    emit_jump_tables(asm_unit);
 
     for (int i = 0; i < asm_unit->labels.bucket_count; ++i)
         if (asm_unit->labels.buckets[i])
@@ -326,5 +463,28 @@ void parse_file(asm_unit_t* asm_unit)
     }
     */
 
-    qsort(asm_unit->strings.ptr, asm_unit->strings.size, sizeof(string_constant_t), string_list_cmp);
+    sort_strings(asm_unit);
+}
+
+void free_asm_unit(asm_unit_t* asm_unit)
+{
+    // the label names are owned by the label table, including the named builder labels
+    for (size_t i = 0; i < asm_unit->labels.bucket_count; ++i)
+        for (hash_node_t* node = asm_unit->labels.buckets[i]; node; node = node->next_node)
+            free((void*)node->key);
+    hash_table_clear(&asm_unit->labels);
+
+    for (int i = 0; i < asm_unit->relocs.size; ++i)
+        free((void*)asm_unit->relocs.ptr[i].target_label);
+    string_pool_free(&asm_unit->string_pool);
+    for (int i = 0; i < asm_unit->sections.size; ++i)
+        free(asm_unit->sections.ptr[i].data.ptr);
+    free_jump_tables(asm_unit);
+
+    free(asm_unit->object_buffer.ptr);
+    free(asm_unit->relocs.ptr);
+    free(asm_unit->strings.ptr);
+    free(asm_unit->label_handles.ptr);
+    free(asm_unit->sections.ptr);
+    free(asm_unit->tables.ptr);
 }
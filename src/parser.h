@@ -5,4 +5,15 @@
 
 void parse_file(asm_unit_t* asm_unit);
 
+// the separate steps of parse_file, for incremental parsing
+void parse_init(asm_unit_t* asm_unit);
+// can be called several times, each call must start at the beginning of a line
+void parse_source(asm_unit_t* asm_unit, const char* source);
+void resolve_relocations(asm_unit_t* asm_unit);
+// code address of a relocation's label, aborts if it is undefined
+int  reloc_target_address(asm_unit_t* asm_unit, const reloc_pair_t* reloc);
+void sort_strings(asm_unit_t* asm_unit);
+
+void free_asm_unit(asm_unit_t* asm_unit);
+
 #endif // PARSER_H_INCLUDED
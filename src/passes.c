@@ -0,0 +1,58 @@
+#include "passes.h"
+
+#include "ir.h"
+#include "cfg_opt.h"
+#include "frame_analysis.h"
+#include "const_pool.h"
+#include "inline.h"
+#include "regcode.h"
+
+void run_passes(asm_unit_t* unit, const asm_options_t* options)
+{
+    if (!options->optimize_cfg && !options->frame_info && !options->const_pool && !options->register_code
+        && !options->inline_size)
+        return;
+
+    ir_program_t prog;
+    ir_lift(unit, &prog);
+
+    // first, so that the other passes see the inlined bodies
+    if (options->inline_size)
+        inline_leaf_functions(&prog, options->inline_size);
+
+    if (options->optimize_cfg)
+        optimize_cfg(&prog);
+
+    frame_table_t frames;
+    if (options->frame_info || options->register_code)
+        analyze_frames(&prog, &frames);
+
+    // before the constant pool rewrites the immediates
+    reg_program_t rprog;
+    int has_register_code = 0;
+    if (options->register_code)
+    {
+        has_register_code = translate_to_registers(&prog, &frames, &rprog) == 0
+                            && verify_register_code(&prog, &rprog) == 0;
+        if (!has_register_code)
+            free_register_program(&rprog);
+    }
+
+    if (options->const_pool)
+        pool_constants(&prog, unit);
+
+    ir_lower(&prog, unit);
+
+    // addresses are only known once lowered
+    if (options->frame_info)
+        emit_frame_section(unit, &prog, &frames);
+    if (options->frame_info || options->register_code)
+        free_frame_table(&frames);
+    if (has_register_code)
+    {
+        emit_register_section(unit, &prog, &rprog);
+        free_register_program(&rprog);
+    }
+
+    ir_free(&prog);
+}
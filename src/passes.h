@@ -0,0 +1,10 @@
+#ifndef PASSES_H_INCLUDED
+#define PASSES_H_INCLUDED
+
+#include "asm_unit_info.h"
+#include "options.h"
+
+// runs the optional passes selected in 'options' on a parsed unit, before its relocations are resolved
+void run_passes(asm_unit_t* unit, const asm_options_t* options);
+
+#endif // PASSES_H_INCLUDED
@@ -0,0 +1,76 @@
+#include "pic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fatal.h"
+#include "image.h"
+#include "opcodes.h"
+#include "parser.h"
+
+static int address_cmp(const void* vlhs, const void* vrhs)
+{
+    uint32_t lhs = *(const uint32_t*)vlhs;
+    uint32_t rhs = *(const uint32_t*)vrhs;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+void resolve_relocations_pic(asm_unit_t* unit)
+{
+    int count = unit->relocs.size;
+    int* targets = malloc((count + 1) * sizeof(int));
+    uint32_t* table = malloc((count + 1) * sizeof(uint32_t));
+    int table_size = 0;
+
+    // label operands always follow their opcode byte
+    for (int i = 0; i < count; ++i)
+    {
+        const reloc_pair_t* reloc = &unit->relocs.ptr[i];
+        opcode_t op = unit->object_buffer.ptr[reloc->reloc_index - 1];
+
+        targets[i] = reloc_target_address(unit, reloc);
+        if (op == OP_pushi)
+            table[table_size++] = targets[i];
+        else if (opcode_infos[op].kind != OPERAND_1OP_LBL)
+        {
+            fprintf(stderr, "'%s' can't take a label operand in position-independent code\n", opcode_infos[op].name);
+            asm_fatal();
+        }
+    }
+
+    qsort(table, table_size, sizeof(uint32_t), address_cmp);
+    int unique = 0;
+    for (int i = 0; i < table_size; ++i)
+        if (unique == 0 || table[unique - 1] != table[i])
+            table[unique++] = table[i];
+    table_size = unique;
+
+    for (int i = 0; i < count; ++i)
+    {
+        size_t index = unit->relocs.ptr[i].reloc_index;
+        uint8_t* operand = unit->object_buffer.ptr + index;
+        int32_t value;
+
+        if (operand[-1] == OP_pushi)
+        {
+            uint32_t target = targets[i];
+            const uint32_t* entry = bsearch(&target, table, table_size, sizeof(uint32_t), address_cmp);
+            operand[-1] = OP_pusha;
+            value = entry - table;
+        }
+        else
+            value = targets[i] - (int32_t)(unit->code_base + index + 4);
+
+        memcpy(operand, &value, sizeof(value));
+    }
+
+    image_section_t* section = image_add_section(unit, "ADDR");
+    image_section_put_u32(section, table_size);
+    for (int i = 0; i < table_size; ++i)
+        image_section_put_u32(section, table[i]);
+
+    free(table);
+    free(targets);
+}
@@ -0,0 +1,17 @@
+#ifndef PIC_H_INCLUDED
+#define PIC_H_INCLUDED
+
+#include "asm_unit_info.h"
+
+/*
+ Position-independent code.
+ jt/jf/jmp/call operands hold the signed distance from the end of the instruction to the target,
+ and 'pushi label' becomes 'pusha #index', which pushes the code base plus entry 'index' of the address table.
+ The table is the "ADDR" image section : u32 count, then count u32 code offsets, sorted.
+ Its presence marks the image as position-independent, so the code can be mapped at any address,
+ shared or concatenated without fixups. Other absolute uses of a label are rejected.
+*/
+
+void resolve_relocations_pic(asm_unit_t* unit);
+
+#endif // PIC_H_INCLUDED
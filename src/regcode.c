@@ -0,0 +1,571 @@
+#include "regcode.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "image.h"
+
+#define REG_MAX_REGISTERS 0x8000
+
+typedef struct translator_t
+{
+    const ir_program_t* prog;
+    const cfg_t* cfg;
+    reg_program_t* rprog;
+    const reg_function_t* fn;
+    uint16_t* slots; // operand holding the value of each stack slot, its own register once materialized
+    int top;         // live slots, depth + args
+    int* const_index;// open addressing table of constant indices, -1 for empty entries
+    int const_capacity;
+} translator_t;
+
+int32_t reg_operand_of(const ir_ins_t* ins)
+{
+    if (ins->target >= 0)
+        return ins->target;
+
+    switch (opcode_infos[ins->op].kind)
+    {
+        case OPERAND_1OP_I_IMM:
+        case OPERAND_1OP_F_IMM:
+        case OPERAND_1OP_B_IMM:
+            return ins->operand.i;
+        case OPERAND_1OP_VAR:
+        case OPERAND_1OP_TBL:
+            return ins->operand.var;
+        default:
+            return 0;
+    }
+}
+
+static uint16_t slot_reg(const translator_t* t, int slot)
+{
+    return t->fn->locals + slot;
+}
+
+static uint32_t const_hash(reg_const_t c)
+{
+    return ((uint32_t)c.value * 0x9E3779B1u) ^ c.type;
+}
+
+static void grow_const_index(translator_t* t)
+{
+    free(t->const_index);
+    t->const_capacity *= 2;
+    t->const_index = malloc(t->const_capacity * sizeof(int));
+    memset(t->const_index, -1, t->const_capacity * sizeof(int));
+    for (int i = 0; i < t->rprog->constants.size; ++i)
+    {
+        uint32_t pos = const_hash(t->rprog->constants.ptr[i]) & (t->const_capacity - 1);
+        while (t->const_index[pos] >= 0)
+            pos = (pos + 1) & (t->const_capacity - 1);
+        t->const_index[pos] = i;
+    }
+}
+
+// returns the operand of the constant, or -1 if the table is full
+static int intern_constant(translator_t* t, reg_const_type_t type, int32_t value)
+{
+    reg_const_t c = {type, value};
+    uint32_t pos = const_hash(c) & (t->const_capacity - 1);
+    for (; t->const_index[pos] >= 0; pos = (pos + 1) & (t->const_capacity - 1))
+    {
+        const reg_const_t* other = &t->rprog->constants.ptr[t->const_index[pos]];
+        if (other->type == type && other->value == value)
+            return REG_CONST | t->const_index[pos];
+    }
+
+    int index = t->rprog->constants.size;
+    if (index >= REG_MAX_REGISTERS)
+        return -1;
+    DYNARRAY_ADD(t->rprog->constants, c);
+    t->const_index[pos] = index;
+    if (t->rprog->constants.size * 2 > t->const_capacity)
+        grow_const_index(t);
+
+    return REG_CONST | index;
+}
+
+static void emit_move(translator_t* t, uint16_t dst, uint16_t src)
+{
+    reg_ins_t ins = {OP_movl, 1, dst, 1, {src, 0, 0}, 0, 0};
+    DYNARRAY_ADD(t->rprog->ins, ins);
+}
+
+static void materialize(translator_t* t, int slot)
+{
+    uint16_t reg = slot_reg(t, slot);
+    if (t->slots[slot] != reg)
+    {
+        emit_move(t, reg, t->slots[slot]);
+        t->slots[slot] = reg;
+    }
+}
+
+// bottom up : a slot can only refer to the register of a slot below it (after a dup)
+static void materialize_all(translator_t* t)
+{
+    for (int i = 0; i < t->top; ++i)
+        materialize(t, i);
+}
+
+// before 'local' is written
+static void materialize_local(translator_t* t, uint16_t local)
+{
+    for (int i = 0; i < t->top; ++i)
+        if (t->slots[i] == local)
+            materialize(t, i);
+}
+
+static void push_operand(translator_t* t, uint16_t operand)
+{
+    t->slots[t->top++] = operand;
+}
+
+static int translate_block(translator_t* t, int block_idx)
+{
+    const basic_block_t* block = &t->cfg->blocks.ptr[block_idx];
+    const reg_function_t* fn = t->fn;
+
+    t->top = t->rprog->block_depth[block_idx] + fn->args;
+    for (int i = 0; i < t->top; ++i)
+        t->slots[i] = slot_reg(t, i);
+
+    for (int i = block->start; i < block->end; ++i)
+    {
+        const ir_ins_t* ins = &t->prog->ins.ptr[i];
+        reg_ins_t out = {ins->op, 0, 0, 0, {0, 0, 0}, reg_operand_of(ins), 0};
+        int constant = -2;
+
+        switch (ins->op)
+        {
+            case OP_nop:
+                continue;
+            case OP_pushi:
+                constant = intern_constant(t, ins->target >= 0 ? REG_CONST_LABEL : REG_CONST_INT, out.operand);
+                break;
+            case OP_pushib:
+                constant = intern_constant(t, REG_CONST_INT, ins->operand.i);
+                break;
+            case OP_pushf:
+                constant = intern_constant(t, REG_CONST_FLOAT, ins->operand.i);
+                break;
+            case OP_pushl:
+                // reads of locals whose address is taken can't be delayed
+                if (fn->addr_taken)
+                {
+                    emit_move(t, slot_reg(t, t->top), ins->operand.var);
+                    push_operand(t, slot_reg(t, t->top));
+                }
+                else
+                    push_operand(t, ins->operand.var);
+                continue;
+            case OP_movl:
+            {
+                uint16_t value = t->slots[--t->top];
+                materialize_local(t, ins->operand.var);
+                if (value != ins->operand.var)
+                    emit_move(t, ins->operand.var, value);
+                continue;
+            }
+            case OP_pop:
+                --t->top;
+                continue;
+            case OP_dup:
+                push_operand(t, t->slots[t->top - 1]);
+                continue;
+            case OP_jt:
+            case OP_jf:
+                out.src_count = 1;
+                out.src[0] = t->slots[--t->top];
+                materialize_all(t);
+                DYNARRAY_ADD(t->rprog->ins, out);
+                continue;
+            case OP_jmp:
+            case OP_ret:
+                materialize_all(t);
+                DYNARRAY_ADD(t->rprog->ins, out);
+                continue;
+            case OP_call:
+            {
+                int callee_idx = t->rprog->function_at[t->cfg->label_block[ins->target]];
+                const reg_function_t* callee = &t->rprog->functions.ptr[callee_idx];
+                materialize_all(t);
+                out.operand = callee_idx;
+                out.base = slot_reg(t, t->top - callee->args);
+                DYNARRAY_ADD(t->rprog->ins, out);
+                t->top -= callee->args;
+                for (int j = 0; j < callee->args + callee->net; ++j, ++t->top)
+                    t->slots[t->top] = slot_reg(t, t->top);
+                continue;
+            }
+            default:
+                break;
+        }
+
+        if (constant != -2)
+        {
+            if (constant < 0)
+                return -1;
+            push_operand(t, constant);
+            continue;
+        }
+
+        int pops, pushes;
+        if (!instruction_stack_effect(ins, &pops, &pushes) || pops > 3 || pushes > 1)
+            return -1;
+
+        if (ins->op == OP_incl || ins->op == OP_decl || ins->op == OP_copyl)
+            materialize_local(t, ins->operand.var);
+
+        out.src_count = pops;
+        t->top -= pops;
+        for (int j = 0; j < pops; ++j)
+            out.src[j] = t->slots[t->top + j];
+        if (pushes)
+        {
+            out.has_dst = 1;
+            out.dst = slot_reg(t, t->top);
+            push_operand(t, out.dst);
+        }
+        DYNARRAY_ADD(t->rprog->ins, out);
+    }
+
+    if (!ir_is_terminator(t->prog->ins.ptr[block->end - 1].op))
+        materialize_all(t);
+
+    return 0;
+}
+
+static const char* function_name(const ir_program_t* prog, const reg_function_t* fn)
+{
+    if (fn->label < 0 || prog->labels.ptr[fn->label].name == NULL)
+        return "<start>";
+    return prog->labels.ptr[fn->label].name;
+}
+
+// assigns each reachable block to a function and computes its entry depth
+static int assign_blocks(const ir_program_t* prog, const cfg_t* cfg, reg_program_t* rprog)
+{
+    int block_count = cfg->blocks.size;
+    int* worklist = malloc((block_count + 1) * sizeof(int));
+    int result = 0;
+
+    for (int f = 0; f < rprog->functions.size && result == 0; ++f)
+    {
+        const reg_function_t* fn = &rprog->functions.ptr[f];
+        int top = 0;
+        if (rprog->block_function[fn->entry_block] >= 0)
+        {
+            fprintf(stderr, "warning : '%s' is inside another function, no register code emitted\n", function_name(prog, fn));
+            result = -1;
+            break;
+        }
+        rprog->block_function[fn->entry_block] = f;
+        rprog->block_depth[fn->entry_block] = 0;
+        worklist[top++] = fn->entry_block;
+
+        while (top && result == 0)
+        {
+            int block_idx = worklist[--top];
+            const basic_block_t* block = &cfg->blocks.ptr[block_idx];
+            int depth = rprog->block_depth[block_idx];
+
+            for (int i = block->start; i < block->end; ++i)
+            {
+                const ir_ins_t* ins = &prog->ins.ptr[i];
+                int pops, pushes;
+                if (ins->op == OP_call)
+                {
+                    int callee_block = ins->target >= 0 ? cfg->label_block[ins->target] : -1;
+                    int callee = callee_block >= 0 ? rprog->function_at[callee_block] : -1;
+                    if (callee < 0)
+                    {
+                        result = -1;
+                        break;
+                    }
+                    pops = rprog->functions.ptr[callee].args;
+                    pushes = pops + rprog->functions.ptr[callee].net;
+                }
+                else if (!instruction_stack_effect(ins, &pops, &pushes))
+                {
+                    result = -1;
+                    break;
+                }
+                depth += pushes - pops;
+            }
+
+            int successors[2] = {block->branch, block->fallthrough};
+            for (int i = 0; i < 2 && result == 0; ++i)
+            {
+                int next = successors[i];
+                if (next < 0)
+                    continue;
+                if (rprog->block_function[next] < 0)
+                {
+                    rprog->block_function[next] = f;
+                    rprog->block_depth[next] = depth;
+                    worklist[top++] = next;
+                }
+                else if (rprog->block_function[next] != f)
+                {
+                    fprintf(stderr, "warning : '%s' and '%s' share code, no register code emitted\n", function_name(prog, fn),
+                            function_name(prog, &rprog->functions.ptr[rprog->block_function[next]]));
+                    result = -1;
+                }
+                else if (rprog->block_depth[next] != depth)
+                    result = -1;
+            }
+        }
+    }
+
+    free(worklist);
+    return result;
+}
+
+static int function_cmp(const void* vlhs, const void* vrhs)
+{
+    const reg_function_t* lhs = vlhs;
+    const reg_function_t* rhs = vrhs;
+
+    return lhs->entry_block - rhs->entry_block;
+}
+
+int translate_to_registers(const ir_program_t* prog, const frame_table_t* frames, reg_program_t* rprog)
+{
+    DYNARRAY_INIT(rprog->ins, 256);
+    DYNARRAY_INIT(rprog->constants, 64);
+    DYNARRAY_INIT(rprog->functions, 16);
+    rprog->block_start = NULL;
+    rprog->block_function = NULL;
+    rprog->block_depth = NULL;
+    rprog->function_at = NULL;
+    rprog->label_ins = NULL;
+    if (prog->ins.size == 0)
+        return -1;
+
+    // the tables hold stack code addresses
+    for (int i = 0; i < prog->ins.size; ++i)
+        if (prog->ins.ptr[i].op == OP_jmpt)
+        {
+            fprintf(stderr, "warning : 'jmpt' has no register code form, no register code emitted\n");
+            return -1;
+        }
+
+    cfg_t cfg;
+    cfg_build(prog, &cfg);
+
+    int result = 0;
+    for (int i = 0; i < frames->frames.size; ++i)
+    {
+        const frame_info_t* info = &frames->frames.ptr[i];
+        reg_function_t fn;
+        fn.entry_block = info->label < 0 ? 0 : cfg.label_block[info->label];
+        fn.label = info->label;
+        fn.locals = info->locals;
+        fn.args = info->args;
+        fn.net = info->net;
+        fn.registers = info->locals + info->args + info->max_stack;
+        fn.addr_taken = 0;
+        DYNARRAY_ADD(rprog->functions, fn);
+
+        if (info->flags & (FRAME_IMPRECISE | FRAME_UNBALANCED))
+        {
+            fprintf(stderr, "warning : the stack depth in '%s' isn't known statically, no register code emitted\n",
+                    function_name(prog, &fn));
+            result = -1;
+        }
+        else if (fn.registers >= REG_MAX_REGISTERS)
+        {
+            fprintf(stderr, "warning : '%s' needs too many registers, no register code emitted\n", function_name(prog, &fn));
+            result = -1;
+        }
+    }
+    // in address order, which is also the order of the section
+    qsort(rprog->functions.ptr, rprog->functions.size, sizeof(reg_function_t), function_cmp);
+
+    int block_count = cfg.blocks.size;
+    rprog->block_start = malloc((block_count + 1) * sizeof(int));
+    rprog->block_function = malloc((block_count + 1) * sizeof(int));
+    rprog->block_depth = malloc((block_count + 1) * sizeof(int));
+    rprog->function_at = malloc((block_count + 1) * sizeof(int));
+    for (int i = 0; i < block_count; ++i)
+        rprog->block_function[i] = rprog->function_at[i] = -1;
+    for (int i = 0; i < rprog->functions.size; ++i)
+        rprog->function_at[rprog->functions.ptr[i].entry_block] = i;
+
+    if (result == 0)
+        result = assign_blocks(prog, &cfg, rprog);
+
+    for (int i = 0; i < block_count && result == 0; ++i)
+        for (int j = cfg.blocks.ptr[i].start; j < cfg.blocks.ptr[i].end; ++j)
+            if (prog->ins.ptr[j].op == OP_getaddrl && rprog->block_function[i] >= 0)
+                rprog->functions.ptr[rprog->block_function[i]].addr_taken = 1;
+
+    translator_t t;
+    t.prog = prog;
+    t.cfg = &cfg;
+    t.rprog = rprog;
+    t.const_capacity = 64;
+    t.const_index = malloc(t.const_capacity * sizeof(int));
+    memset(t.const_index, -1, t.const_capacity * sizeof(int));
+    int max_slots = 1;
+    for (int i = 0; i < rprog->functions.size; ++i)
+        if (rprog->functions.ptr[i].registers - rprog->functions.ptr[i].locals > max_slots)
+            max_slots = rprog->functions.ptr[i].registers - rprog->functions.ptr[i].locals;
+    t.slots = malloc(max_slots * sizeof(uint16_t));
+
+    for (int i = 0; i < block_count && result == 0; ++i)
+    {
+        rprog->block_start[i] = rprog->ins.size;
+        if (rprog->block_function[i] < 0)
+            continue;
+        t.fn = &rprog->functions.ptr[rprog->block_function[i]];
+        if (translate_block(&t, i) != 0)
+        {
+            fprintf(stderr, "warning : '%s' can't be translated to register code\n", function_name(prog, t.fn));
+            result = -1;
+        }
+    }
+    rprog->block_start[block_count] = rprog->ins.size;
+
+    if (result == 0)
+    {
+        rprog->label_ins = malloc((prog->labels.size + 1) * sizeof(int));
+        for (int i = 0; i < prog->labels.size; ++i)
+        {
+            int block = cfg.label_block[i];
+            rprog->label_ins[i] = rprog->block_start[block < 0 ? block_count : block];
+        }
+    }
+
+    free(t.slots);
+    free(t.const_index);
+    cfg_free(&cfg);
+
+    return result;
+}
+
+static int reg_ins_size(const reg_ins_t* ins)
+{
+    int size = 1 + (ins->has_dst ? 2 : 0) + 2 * ins->src_count;
+    switch (ins->op)
+    {
+        case OP_movl:
+        case OP_ret:
+            return size;
+        case OP_jt:
+        case OP_jf:
+        case OP_jmp:
+        case OP_call:
+            return size + 4;
+        default:
+            return size + operand_size(opcode_infos[ins->op].kind);
+    }
+}
+
+static uint32_t label_address(asm_unit_t* unit, const ir_program_t* prog, int label)
+{
+    int handle = prog->labels.ptr[label].handle;
+    return handle < 0 ? 0 : unit->label_handles.ptr[handle].addr;
+}
+
+void emit_register_section(asm_unit_t* unit, const ir_program_t* prog, const reg_program_t* rprog)
+{
+    uint32_t* offsets = malloc((rprog->ins.size + 1) * sizeof(uint32_t));
+    uint32_t offset = 0;
+    for (int i = 0; i < rprog->ins.size; ++i)
+    {
+        offsets[i] = offset;
+        offset += reg_ins_size(&rprog->ins.ptr[i]);
+    }
+    offsets[rprog->ins.size] = offset;
+
+    image_section_t* section = image_add_section(unit, "RCOD");
+    image_section_put_u16(section, rprog->constants.size);
+    for (int i = 0; i < rprog->constants.size; ++i)
+    {
+        const reg_const_t* c = &rprog->constants.ptr[i];
+        if (c->type == REG_CONST_LABEL)
+        {
+            DYNARRAY_ADD(section->data, (uint8_t)REG_CONST_INT);
+            image_section_put_u32(section, label_address(unit, prog, c->value));
+        }
+        else
+        {
+            DYNARRAY_ADD(section->data, (uint8_t)c->type);
+            image_section_put_u32(section, c->value);
+        }
+    }
+
+    image_section_put_u16(section, rprog->functions.size);
+    for (int i = 0; i < rprog->functions.size; ++i)
+    {
+        const reg_function_t* fn = &rprog->functions.ptr[i];
+        image_section_put_u32(section, fn->label < 0 ? 0 : label_address(unit, prog, fn->label));
+        image_section_put_u32(section, offsets[rprog->block_start[fn->entry_block]]);
+        image_section_put_u16(section, fn->locals);
+        image_section_put_u16(section, fn->args);
+        image_section_put_u16(section, (uint16_t)(int16_t)fn->net);
+        image_section_put_u16(section, fn->registers);
+    }
+
+    image_section_put_u32(section, offset);
+    for (int i = 0; i < rprog->ins.size; ++i)
+    {
+        const reg_ins_t* ins = &rprog->ins.ptr[i];
+        DYNARRAY_ADD(section->data, (uint8_t)ins->op);
+        switch (ins->op)
+        {
+            case OP_movl:
+            case OP_ret:
+                break;
+            case OP_jt:
+            case OP_jf:
+            case OP_jmp:
+                image_section_put_u32(section, offsets[rprog->label_ins[ins->operand]]);
+                break;
+            case OP_call:
+                image_section_put_u16(section, ins->operand);
+                image_section_put_u16(section, ins->base);
+                break;
+            default:
+                switch (opcode_infos[ins->op].kind)
+                {
+                    case OPERAND_1OP_I_IMM:
+                    case OPERAND_1OP_F_IMM:
+                        image_section_put_u32(section, ins->operand);
+                        break;
+                    case OPERAND_1OP_B_IMM:
+                        DYNARRAY_ADD(section->data, (uint8_t)ins->operand);
+                        break;
+                    case OPERAND_1OP_VAR:
+                    case OPERAND_1OP_TBL:
+                        image_section_put_u16(section, ins->operand);
+                        break;
+                    default:
+                        break;
+                }
+        }
+
+        if (ins->has_dst)
+            image_section_put_u16(section, ins->dst);
+        for (int j = 0; j < ins->src_count; ++j)
+            image_section_put_u16(section, ins->src[j]);
+    }
+
+    free(offsets);
+}
+
+void free_register_program(reg_program_t* rprog)
+{
+    free(rprog->ins.ptr);
+    free(rprog->constants.ptr);
+    free(rprog->functions.ptr);
+    free(rprog->block_start);
+    free(rprog->block_function);
+    free(rprog->block_depth);
+    free(rprog->function_at);
+    free(rprog->label_ins);
+}
@@ -0,0 +1,99 @@
+#ifndef REGCODE_H_INCLUDED
+#define REGCODE_H_INCLUDED
+
+#include "asm_unit_info.h"
+#include "frame_analysis.h"
+#include "ir.h"
+
+/*
+ Register bytecode, emitted next to the stack code as an "RCOD" image section.
+ Each function is translated block by block : the locals and the operand stack slots become registers,
+ and pushes of locals and constants are folded into the operands of the instruction that consumes them,
+ so 'pushl 0; pushi #2; mod; pushi #0; eq; jf .L0' becomes 'mod s0, l0, #2; eq s0, s0, #0; jf s0, .L0'.
+ At block boundaries, calls and returns, the values are in their stack slot registers.
+
+ Registers of a function : locals first, then one per stack depth from -args to max_stack :
+   local i -> i, stack depth d -> locals + args + d
+ Operands are uint16_t : a register, or 0x8000 | index in the constant table.
+
+ Section layout :
+   uint16_t constant count, then for each constant : uint8_t type (0 int, 1 float), uint32_t value
+   uint16_t function count, then sorted by address :
+     uint32_t stack code address, uint32_t register code offset,
+     uint16_t locals, uint16_t args, int16_t net, uint16_t registers
+   uint32_t code size, code
+ Instructions use the stack opcode bytes : opcode, then the stack instruction's own operand (which can decide
+ the layout, as for syscall), then uint16_t dst if the stack instruction pushes a value, then one uint16_t source
+ per popped value (deepest first).
+ Exceptions :
+   movl  : uint16_t dst, uint16_t src, a plain move
+   jt/jf : uint32_t register code offset, uint16_t src
+   jmp   : uint32_t register code offset
+   call  : uint16_t function index, uint16_t base : the callee's arguments are in [base, base + args), and
+           its results (args + net values, see frame_analysis.h) are written back there
+   ret   : no operand, the results are in the registers of depths [-args, net)
+ pushl, pushi, pushib, pushf, dup and pop don't exist in register code, and units using jmpt aren't translated.
+ Label addresses pushed with pushi are integer constants.
+*/
+
+#define REG_CONST 0x8000
+
+typedef enum reg_const_type_t
+{
+    REG_CONST_INT,
+    REG_CONST_FLOAT,
+    REG_CONST_LABEL // resolved to an integer when emitted
+} reg_const_type_t;
+
+typedef struct reg_const_t
+{
+    reg_const_type_t type;
+    int32_t value; // float bits, or label index
+} reg_const_t;
+
+typedef struct reg_ins_t
+{
+    opcode_t op;
+    int has_dst;
+    uint16_t dst;
+    int src_count;
+    uint16_t src[3];
+    int32_t operand; // stack operand, label index for branches, function index for call
+    uint16_t base;   // call
+} reg_ins_t;
+
+typedef struct reg_function_t
+{
+    int entry_block;
+    int label;       // -1 for the start of the code
+    int locals, args, net, registers;
+    int addr_taken;  // uses getaddrl, locals may change behind any instruction with side effects
+} reg_function_t;
+
+typedef struct reg_program_t
+{
+    DYNARRAY(reg_ins_t) ins;
+    DYNARRAY(reg_const_t) constants;
+    DYNARRAY(reg_function_t) functions;
+    int* block_start;    // first instruction of each block, block_start[block count] is the end
+    int* block_function; // function of each block, -1 if unreachable
+    int* block_depth;    // stack depth at the entry of each block
+    int* function_at;    // function starting at each block, -1 if none
+    int* label_ins;      // instruction each label is bound to
+} reg_program_t;
+
+// operand of a stack instruction as stored in reg_ins_t : immediate bits, variable index or label index
+int32_t reg_operand_of(const ir_ins_t* ins);
+
+// returns 0 and fills 'rprog', or warns on stderr and returns -1 when the program can't be translated :
+// imprecise or unbalanced frames (see frame_analysis.h), or blocks shared between functions
+int translate_to_registers(const ir_program_t* prog, const frame_table_t* frames, reg_program_t* rprog);
+// translation validation : evaluates each block of both programs symbolically and checks that they have
+// the same side effects, in the same order, and end with the same locals, stack and control flow.
+// returns 0 if they're equivalent, reports the first mismatch on stderr otherwise
+int verify_register_code(const ir_program_t* prog, const reg_program_t* rprog);
+// adds the "RCOD" section, must be called once the program has been lowered into 'unit'
+void emit_register_section(asm_unit_t* unit, const ir_program_t* prog, const reg_program_t* rprog);
+void free_register_program(reg_program_t* rprog);
+
+#endif // REGCODE_H_INCLUDED
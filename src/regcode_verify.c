@@ -0,0 +1,402 @@
+#include "regcode.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cfg.h"
+
+// Both versions of a block are evaluated over symbolic terms. Terms are hash-consed, so two values are equal
+// exactly when their term indices are.
+// Instructions with side effects are chained : each effect term refers to the previous one, so comparing the
+// last effect of both versions compares the whole sequence.
+
+typedef enum term_kind_t
+{
+    TERM_NONE,    // empty list, start of the effect chain, fallthrough
+    TERM_LOCAL,   // value of a local at the start of the block
+    TERM_SLOT,    // value of a stack slot at the start of the block
+    TERM_CONST,   // op : reg_const_type_t
+    TERM_PURE,    // result of an instruction without side effects
+    TERM_EFFECT,  // kids : argument list, previous effect
+    TERM_LIST,    // kids : value, rest of the list
+    TERM_RESULT,  // imm-th result of an effect
+    TERM_CLOBBER, // local imm after an effect, when the function takes the address of its locals
+    TERM_CONTROL  // end of the block, op : jt/jf/jmp/ret, imm : label, kids : condition
+} term_kind_t;
+
+typedef struct term_t
+{
+    term_kind_t kind;
+    int op;
+    int32_t imm;
+    int kids[3];
+} term_t;
+
+typedef struct term_table_t
+{
+    DYNARRAY(term_t) terms;
+    int* index; // open addressing, -1 for empty entries
+    int capacity;
+} term_table_t;
+
+typedef struct sym_state_t
+{
+    int* locals;
+    int effect; // last effect
+} sym_state_t;
+
+// instructions that only compute a value from their operands
+static const uint8_t pure_ops[256] =
+{
+    [OP_isnull] = 1, [OP_add] = 1, [OP_sub] = 1, [OP_mul] = 1, [OP_inc] = 1, [OP_dec] = 1,
+    [OP_shl] = 1, [OP_shr] = 1, [OP_cvtf2i] = 1, [OP_cvti2f] = 1,
+    [OP_eq] = 1, [OP_neq] = 1, [OP_lt] = 1, [OP_land] = 1, [OP_lor] = 1, [OP_lnot] = 1, [OP_feq] = 1,
+    [OP_pow] = 1, [OP_ln] = 1, [OP_log10] = 1, [OP_exp] = 1, [OP_sqrt] = 1, [OP_abs] = 1, [OP_fabs] = 1,
+    [OP_ceil] = 1, [OP_floor] = 1, [OP_rad2deg] = 1, [OP_deg2rad] = 1,
+    [OP_cos] = 1, [OP_sin] = 1, [OP_tan] = 1, [OP_acos] = 1, [OP_asin] = 1, [OP_atan] = 1, [OP_atan2] = 1,
+    [OP_eql] = 1, [OP_neql] = 1, [OP_ltl] = 1, [OP_getaddrl] = 1, [OP_cmov] = 1,
+};
+
+static uint32_t term_hash(const term_t* term)
+{
+    uint32_t hash = term->kind * 0x9E3779B1u;
+    hash = (hash ^ term->op) * 0x85EBCA6Bu;
+    hash = (hash ^ (uint32_t)term->imm) * 0xC2B2AE35u;
+    for (int i = 0; i < 3; ++i)
+        hash = (hash ^ (uint32_t)term->kids[i]) * 0x27D4EB2Fu;
+    return hash ^ (hash >> 15);
+}
+
+static void grow_terms(term_table_t* table)
+{
+    free(table->index);
+    table->capacity *= 2;
+    table->index = malloc(table->capacity * sizeof(int));
+    memset(table->index, -1, table->capacity * sizeof(int));
+    for (int i = 0; i < table->terms.size; ++i)
+    {
+        uint32_t pos = term_hash(&table->terms.ptr[i]) & (table->capacity - 1);
+        while (table->index[pos] >= 0)
+            pos = (pos + 1) & (table->capacity - 1);
+        table->index[pos] = i;
+    }
+}
+
+static int mk_term(term_table_t* table, term_kind_t kind, int op, int32_t imm, int a, int b, int c)
+{
+    term_t term = {kind, op, imm, {a, b, c}};
+    uint32_t pos = term_hash(&term) & (table->capacity - 1);
+    for (; table->index[pos] >= 0; pos = (pos + 1) & (table->capacity - 1))
+        if (memcmp(&table->terms.ptr[table->index[pos]], &term, sizeof(term_t)) == 0)
+            return table->index[pos];
+
+    DYNARRAY_ADD(table->terms, term);
+    table->index[pos] = table->terms.size - 1;
+    if (table->terms.size * 2 > table->capacity)
+        grow_terms(table);
+
+    return table->terms.size - 1;
+}
+
+static int mk_list(term_table_t* table, const int* values, int count)
+{
+    int list = mk_term(table, TERM_NONE, 0, 0, -1, -1, -1);
+    for (int i = count - 1; i >= 0; --i)
+        list = mk_term(table, TERM_LIST, 0, 0, values[i], list, -1);
+    return list;
+}
+
+static int uses_local_value(opcode_t op)
+{
+    return op == OP_eql || op == OP_neql || op == OP_ltl || op == OP_copyl;
+}
+
+// evaluates a generic instruction, shared by both versions
+// args are the popped values (deepest first), returns the pushed value if 'pushes'
+static int apply(term_table_t* table, const reg_function_t* fn, sym_state_t* state,
+                 opcode_t op, int32_t imm, const int* args, int pops, int pushes)
+{
+    int kids[4];
+    int count = pops;
+    memcpy(kids, args, pops * sizeof(int));
+    if (uses_local_value(op))
+        kids[count++] = state->locals[imm];
+
+    if (op == OP_incl || op == OP_decl)
+    {
+        state->locals[imm] = mk_term(table, TERM_PURE, op, 0, state->locals[imm], -1, -1);
+        return -1;
+    }
+
+    if (pure_ops[op])
+    {
+        while (count < 3)
+            kids[count++] = -1;
+        return mk_term(table, TERM_PURE, op, imm, kids[0], kids[1], kids[2]);
+    }
+
+    state->effect = mk_term(table, TERM_EFFECT, op, imm, mk_list(table, kids, count), state->effect, -1);
+    if (op == OP_copyl)
+        state->locals[imm] = mk_term(table, TERM_RESULT, 0, 1, state->effect, -1, -1);
+    if (fn->addr_taken)
+        for (int i = 0; i < fn->locals; ++i)
+            state->locals[i] = mk_term(table, TERM_CLOBBER, 0, i, state->effect, -1, -1);
+
+    return pushes ? mk_term(table, TERM_RESULT, 0, 0, state->effect, -1, -1) : -1;
+}
+
+// the results of a call go back to where its arguments were
+static void apply_call(term_table_t* table, const reg_function_t* fn, sym_state_t* state,
+                       int callee_idx, const reg_function_t* callee, int* values)
+{
+    state->effect = mk_term(table, TERM_EFFECT, OP_call, callee_idx, mk_list(table, values, callee->args), state->effect, -1);
+    for (int i = 0; i < callee->args + callee->net; ++i)
+        values[i] = mk_term(table, TERM_RESULT, 0, i, state->effect, -1, -1);
+    if (fn->addr_taken)
+        for (int i = 0; i < fn->locals; ++i)
+            state->locals[i] = mk_term(table, TERM_CLOBBER, 0, i, state->effect, -1, -1);
+}
+
+typedef struct verifier_t
+{
+    const ir_program_t* prog;
+    const reg_program_t* rprog;
+    const cfg_t* cfg;
+    term_table_t table;
+    int* stack;     // slots of the stack version
+    int* locals;    // locals of the stack version
+    int* regs;      // registers of the register version
+} verifier_t;
+
+static int const_term(verifier_t* v, reg_const_type_t type, int32_t value)
+{
+    return mk_term(&v->table, TERM_CONST, type, value, -1, -1, -1);
+}
+
+// returns the control term, or -1 on an invalid stack access
+static int eval_stack_block(verifier_t* v, const reg_function_t* fn, int block_idx, sym_state_t* state, int* top)
+{
+    const basic_block_t* block = &v->cfg->blocks.ptr[block_idx];
+    int slot_count = fn->registers - fn->locals;
+    int* stack = v->stack;
+    int control = mk_term(&v->table, TERM_NONE, 0, 0, -1, -1, -1);
+
+    for (int i = block->start; i < block->end; ++i)
+    {
+        const ir_ins_t* ins = &v->prog->ins.ptr[i];
+        int32_t imm = reg_operand_of(ins);
+        int pops, pushes;
+
+        if (ins->op == OP_call)
+        {
+            int callee_idx = v->rprog->function_at[v->cfg->label_block[ins->target]];
+            const reg_function_t* callee = &v->rprog->functions.ptr[callee_idx];
+            if (*top < callee->args || *top - callee->args + callee->args + callee->net > slot_count)
+                return -1;
+            *top -= callee->args;
+            apply_call(&v->table, fn, state, callee_idx, callee, stack + *top);
+            *top += callee->args + callee->net;
+            continue;
+        }
+
+        instruction_stack_effect(ins, &pops, &pushes);
+        if (*top < pops || *top - pops + pushes > slot_count)
+            return -1;
+
+        switch (ins->op)
+        {
+            case OP_nop:
+                break;
+            case OP_pushi:
+                stack[(*top)++] = const_term(v, ins->target >= 0 ? REG_CONST_LABEL : REG_CONST_INT, imm);
+                break;
+            case OP_pushib:
+                stack[(*top)++] = const_term(v, REG_CONST_INT, imm);
+                break;
+            case OP_pushf:
+                stack[(*top)++] = const_term(v, REG_CONST_FLOAT, imm);
+                break;
+            case OP_pushl:
+                stack[(*top)++] = state->locals[imm];
+                break;
+            case OP_movl:
+                state->locals[imm] = stack[--(*top)];
+                break;
+            case OP_pop:
+                --(*top);
+                break;
+            case OP_dup:
+                stack[*top] = stack[*top - 1];
+                ++(*top);
+                break;
+            case OP_jt:
+            case OP_jf:
+                --(*top);
+                control = mk_term(&v->table, TERM_CONTROL, ins->op, imm, stack[*top], -1, -1);
+                break;
+            case OP_jmp:
+            case OP_ret:
+                control = mk_term(&v->table, TERM_CONTROL, ins->op, imm, -1, -1, -1);
+                break;
+            default:
+            {
+                *top -= pops;
+                int result = apply(&v->table, fn, state, ins->op, imm, stack + *top, pops, pushes);
+                if (pushes)
+                    stack[(*top)++] = result;
+            }
+        }
+    }
+
+    return control;
+}
+
+static int valid_operand(const verifier_t* v, const reg_function_t* fn, uint16_t operand)
+{
+    if (operand & REG_CONST)
+        return (operand & ~REG_CONST) < v->rprog->constants.size;
+    return operand < fn->registers;
+}
+
+static int read_operand(verifier_t* v, uint16_t operand)
+{
+    if (operand & REG_CONST)
+    {
+        const reg_const_t* c = &v->rprog->constants.ptr[operand & ~REG_CONST];
+        return const_term(v, c->type, c->value);
+    }
+    return v->regs[operand];
+}
+
+// returns the control term, or -1 on an invalid register
+static int eval_register_block(verifier_t* v, const reg_function_t* fn, int block_idx, sym_state_t* state)
+{
+    int control = mk_term(&v->table, TERM_NONE, 0, 0, -1, -1, -1);
+
+    for (int i = v->rprog->block_start[block_idx]; i < v->rprog->block_start[block_idx + 1]; ++i)
+    {
+        const reg_ins_t* ins = &v->rprog->ins.ptr[i];
+        int args[3];
+        for (int j = 0; j < ins->src_count; ++j)
+        {
+            if (!valid_operand(v, fn, ins->src[j]))
+                return -1;
+            args[j] = read_operand(v, ins->src[j]);
+        }
+        if (ins->has_dst && (ins->dst & REG_CONST || ins->dst >= fn->registers))
+            return -1;
+
+        switch (ins->op)
+        {
+            case OP_movl:
+                v->regs[ins->dst] = args[0];
+                break;
+            case OP_jt:
+            case OP_jf:
+                control = mk_term(&v->table, TERM_CONTROL, ins->op, ins->operand, args[0], -1, -1);
+                break;
+            case OP_jmp:
+            case OP_ret:
+                control = mk_term(&v->table, TERM_CONTROL, ins->op, ins->operand, -1, -1, -1);
+                break;
+            case OP_call:
+            {
+                const reg_function_t* callee = &v->rprog->functions.ptr[ins->operand];
+                if (ins->base + callee->args + callee->net > fn->registers || ins->base < fn->locals)
+                    return -1;
+                apply_call(&v->table, fn, state, ins->operand, callee, v->regs + ins->base);
+                break;
+            }
+            default:
+            {
+                int result = apply(&v->table, fn, state, ins->op, ins->operand, args, ins->src_count, ins->has_dst);
+                if (ins->has_dst)
+                    v->regs[ins->dst] = result;
+            }
+        }
+    }
+
+    return control;
+}
+
+static int verify_block(verifier_t* v, int block_idx)
+{
+    const reg_function_t* fn = &v->rprog->functions.ptr[v->rprog->block_function[block_idx]];
+    int entry_top = v->rprog->block_depth[block_idx] + fn->args;
+    int start_effect = mk_term(&v->table, TERM_NONE, 0, 0, -1, -1, -1);
+
+    for (int i = 0; i < fn->locals; ++i)
+        v->locals[i] = v->regs[i] = mk_term(&v->table, TERM_LOCAL, 0, i, -1, -1, -1);
+    for (int i = 0; i < fn->registers - fn->locals; ++i)
+        v->stack[i] = v->regs[fn->locals + i] = mk_term(&v->table, TERM_SLOT, 0, i, -1, -1, -1);
+
+    sym_state_t stack_state = {v->locals, start_effect};
+    int top = entry_top;
+    int stack_control = eval_stack_block(v, fn, block_idx, &stack_state, &top);
+    if (stack_control < 0)
+        return -1;
+
+    sym_state_t reg_state = {v->regs, start_effect};
+    int reg_control = eval_register_block(v, fn, block_idx, &reg_state);
+    if (reg_control < 0)
+        return -1;
+
+    if (stack_control != reg_control || stack_state.effect != reg_state.effect)
+        return -1;
+    for (int i = 0; i < fn->locals; ++i)
+        if (v->locals[i] != v->regs[i])
+            return -1;
+    for (int i = 0; i < top; ++i)
+        if (v->stack[i] != v->regs[fn->locals + i])
+            return -1;
+
+    return 0;
+}
+
+int verify_register_code(const ir_program_t* prog, const reg_program_t* rprog)
+{
+    cfg_t cfg;
+    cfg_build(prog, &cfg);
+
+    int max_registers = 1;
+    for (int i = 0; i < rprog->functions.size; ++i)
+        if (rprog->functions.ptr[i].registers > max_registers)
+            max_registers = rprog->functions.ptr[i].registers;
+
+    verifier_t v;
+    v.prog = prog;
+    v.rprog = rprog;
+    v.cfg = &cfg;
+    DYNARRAY_INIT(v.table.terms, 1024);
+    v.table.capacity = 2048;
+    v.table.index = malloc(v.table.capacity * sizeof(int));
+    memset(v.table.index, -1, v.table.capacity * sizeof(int));
+    v.stack = malloc(max_registers * sizeof(int));
+    v.locals = malloc(max_registers * sizeof(int));
+    v.regs = malloc(max_registers * sizeof(int));
+
+    int result = 0;
+    for (int i = 0; i < cfg.blocks.size; ++i)
+    {
+        if (rprog->block_function[i] < 0)
+            continue;
+        if (verify_block(&v, i) != 0)
+        {
+            const reg_function_t* fn = &rprog->functions.ptr[rprog->block_function[i]];
+            const char* name = fn->label >= 0 && prog->labels.ptr[fn->label].name ? prog->labels.ptr[fn->label].name : "<start>";
+            fprintf(stderr, "error : the register code of '%s' differs from the stack code in the block at instruction %d\n",
+                    name, cfg.blocks.ptr[i].start);
+            result = -1;
+            break;
+        }
+    }
+
+    free(v.table.terms.ptr);
+    free(v.table.index);
+    free(v.stack);
+    free(v.locals);
+    free(v.regs);
+    cfg_free(&cfg);
+
+    return result;
+}
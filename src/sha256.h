@@ -0,0 +1,21 @@
+#ifndef SHA256_H_INCLUDED
+#define SHA256_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+// FIPS 180-4 SHA-256, used where a key must not collide (the output cache), unlike mem_hash.
+
+typedef struct sha256_t
+{
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t  block[64];
+    size_t   block_len;
+} sha256_t;
+
+void sha256_init(sha256_t* ctx);
+void sha256_update(sha256_t* ctx, const void* data, size_t len);
+void sha256_final(sha256_t* ctx, uint8_t digest[32]);
+
+#endif // SHA256_H_INCLUDED
@@ -0,0 +1,298 @@
+#include "stream.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "parser.h"
+#include "image.h"
+#include "jump_table.h"
+
+#define STREAM_BLOCK_SIZE (64*1024)
+
+typedef struct pending_ref_t
+{
+    uint32_t offset; // offset of the operand in the code section
+    struct pending_ref_t* next;
+} pending_ref_t;
+
+typedef struct pending_label_t
+{
+    const char* label;
+    pending_ref_t* refs;
+} pending_label_t;
+
+typedef struct spooled_string_t
+{
+    unsigned int id;
+    uint16_t len;
+    off_t offset; // offset in the string spool
+} spooled_string_t;
+
+typedef struct stream_state_t
+{
+    int code_fd;
+    int string_fd;
+    off_t string_spool_size;
+    hash_table_t pending; // label -> pending_label_t
+    DYNARRAY(spooled_string_t) strings;
+} stream_state_t;
+
+static void write_all(int fd, const void* data, size_t len, off_t offset)
+{
+    const uint8_t* ptr = data;
+    while (len)
+    {
+        ssize_t written = pwrite(fd, ptr, len, offset);
+        if (written <= 0)
+        {
+            perror("pwrite");
+            abort();
+        }
+        ptr += written;
+        offset += written;
+        len -= written;
+    }
+}
+
+static void read_all(int fd, void* data, size_t len, off_t offset)
+{
+    uint8_t* ptr = data;
+    while (len)
+    {
+        ssize_t rd = pread(fd, ptr, len, offset);
+        if (rd <= 0)
+        {
+            perror("pread");
+            abort();
+        }
+        ptr += rd;
+        offset += rd;
+        len -= rd;
+    }
+}
+
+static int temp_fd()
+{
+    FILE* file = tmpfile();
+    if (!file)
+    {
+        perror("tmpfile");
+        abort();
+    }
+    // the FILE is never closed, the descriptor is only used with pread/pwrite
+    return fileno(file);
+}
+
+// backpatches the references that were waiting for 'label'
+static void stream_label_defined(asm_unit_t* unit, const char* label, uint64_t hash, int addr)
+{
+    stream_state_t* state = unit->user_data;
+
+    hash_value_t* val = hash_table_get_hashed(&state->pending, label, hash);
+    if (!val)
+        return;
+
+    pending_label_t* pending = val->ptr;
+    uint32_t addr32 = addr;
+    pending_ref_t* ref = pending->refs;
+    while (ref)
+    {
+        pending_ref_t* next = ref->next;
+        write_all(state->code_fd, &addr32, sizeof(uint32_t), ref->offset);
+        free(ref);
+        ref = next;
+    }
+
+    hash_table_remove_hashed(&state->pending, label, hash);
+    free((void*)pending->label);
+    free(pending);
+}
+
+// resolves what can be resolved in the current block and writes it out
+static void stream_flush(asm_unit_t* unit, stream_state_t* state)
+{
+    for (int i = 0; i < unit->relocs.size; ++i)
+    {
+        reloc_pair_t* reloc = &unit->relocs.ptr[i];
+        hash_value_t* label_addr = hash_table_get_hashed(&unit->labels, reloc->target_label, reloc->target_hash);
+        if (label_addr)
+        {
+            *(uint32_t*)(unit->object_buffer.ptr + reloc->reloc_index) = label_addr->idx;
+            free((void*)reloc->target_label);
+            continue;
+        }
+
+        pending_ref_t* ref = malloc(sizeof(pending_ref_t));
+        ref->offset = unit->code_base + reloc->reloc_index;
+        ref->next = NULL;
+
+        hash_value_t* val = hash_table_get_hashed(&state->pending, reloc->target_label, reloc->target_hash);
+        if (val)
+        {
+            pending_label_t* pending = val->ptr;
+            ref->next = pending->refs;
+            pending->refs = ref;
+            free((void*)reloc->target_label);
+        }
+        else
+        {
+            pending_label_t* pending = malloc(sizeof(pending_label_t));
+            pending->label = reloc->target_label; // the pending table owns the label string now
+            pending->refs = ref;
+            hash_table_insert_hashed(&state->pending, pending->label, reloc->target_hash, (hash_value_t){.ptr = pending});
+        }
+    }
+    unit->relocs.size = 0;
+
+    write_all(state->code_fd, unit->object_buffer.ptr, unit->object_buffer.size, unit->code_base);
+    unit->code_base += unit->object_buffer.size;
+    unit->object_buffer.size = 0;
+
+    for (int i = 0; i < unit->strings.size; ++i)
+    {
+        string_constant_t* str = &unit->strings.ptr[i];
+        write_all(state->string_fd, str->str, str->len, state->string_spool_size);
+        DYNARRAY_ADD(state->strings, (spooled_string_t){str->id, str->len, state->string_spool_size});
+        state->string_spool_size += str->len;
+    }
+    unit->strings.size = 0;
+    string_pool_clear(&unit->string_pool);
+}
+
+static void report_unresolved(hash_node_t* node)
+{
+    fprintf(stderr, "label '%s' not found\n", node->key);
+}
+
+static int spooled_string_cmp(const void* vlhs, const void* vrhs)
+{
+    const spooled_string_t* lhs = vlhs;
+    const spooled_string_t* rhs = vrhs;
+
+    return lhs->id - rhs->id;
+}
+
+static void stream_write_image(asm_unit_t* unit, stream_state_t* state, FILE* file)
+{
+    qsort(state->strings.ptr, state->strings.size, sizeof(spooled_string_t), spooled_string_cmp);
+
+    image_write_header(file, image_init_address(unit), state->strings.size, unit->sections.size != 0);
+
+    char* block = malloc(STREAM_BLOCK_SIZE);
+    for (int i = 0; i < state->strings.size; ++i)
+    {
+        spooled_string_t* str = &state->strings.ptr[i];
+        read_all(state->string_fd, block, str->len, str->offset); // len < 0x10000 <= STREAM_BLOCK_SIZE
+        image_write_string(file, block, str->len);
+    }
+    image_write_sections(file, unit);
+
+    for (off_t offset = 0; offset < unit->code_base; )
+    {
+        size_t len = unit->code_base - offset;
+        if (len > STREAM_BLOCK_SIZE)
+            len = STREAM_BLOCK_SIZE;
+        read_all(state->code_fd, block, len, offset);
+        fwrite(block, 1, len, file);
+        offset += len;
+    }
+
+    free(block);
+}
+
+int assemble_stream(FILE* input, const char* out_name)
+{
+    asm_unit_t unit;
+    parse_init(&unit);
+    unit.source = NULL;
+
+    stream_state_t state;
+    state.code_fd = temp_fd();
+    state.string_fd = temp_fd();
+    state.string_spool_size = 0;
+    state.pending = mk_hash_table(1031);
+    DYNARRAY_INIT(state.strings, 256);
+
+    unit.label_defined = stream_label_defined;
+    unit.user_data = &state;
+
+    // 'block' holds the unfinished line of the previous read followed by the new data
+    size_t capacity = STREAM_BLOCK_SIZE;
+    size_t used = 0;
+    char* block = malloc(capacity + 1);
+
+    for (;;)
+    {
+        if (capacity - used < STREAM_BLOCK_SIZE/2) // a very long line
+        {
+            capacity *= 2;
+            block = realloc(block, capacity + 1);
+        }
+
+        size_t rd = fread(block + used, 1, capacity - used, input);
+        used += rd;
+        int eof = (rd == 0);
+
+        // only parse complete lines, except at the end of the input
+        size_t parse_len = used;
+        if (!eof)
+        {
+            while (parse_len > 0 && block[parse_len-1] != '\n')
+                --parse_len;
+            if (parse_len == 0)
+                continue;
+        }
+
+        char saved = block[parse_len];
+        block[parse_len] = '\0';
+        parse_source(&unit, block);
+        block[parse_len] = saved;
+
+        memmove(block, block + parse_len, used - parse_len);
+        used -= parse_len;
+
+        stream_flush(&unit, &state);
+
+        if (eof)
+            break;
+    }
+    free(block);
+
+    if (ferror(input))
+    {
+        perror("read");
+        return -1;
+    }
+    if (state.pending.count != 0)
+    {
+        hash_table_iterate(&state.pending, report_unresolved);
+        return -1;
+    }
+    // every label is known by now
+    emit_jump_tables(&unit);
+
+    FILE* file = fopen(out_name, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "could not open output file '%s'\n", out_name);
+        return -1;
+    }
+    stream_write_image(&unit, &state, file);
+    fclose(file);
+
+    free(unit.object_buffer.ptr);
+    free(unit.relocs.ptr);
+    free(unit.strings.ptr);
+    string_pool_free(&unit.string_pool);
+    for (int i = 0; i < unit.sections.size; ++i)
+        free(unit.sections.ptr[i].data.ptr);
+    free(unit.sections.ptr);
+    free_jump_tables(&unit);
+    free(unit.tables.ptr);
+    free(state.strings.ptr);
+    hash_table_clear(&unit.labels);
+    hash_table_clear(&state.pending);
+
+    return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef STREAM_H_INCLUDED
+#define STREAM_H_INCLUDED
+
+#include <stdio.h>
+
+// Assembles 'input' block by block, in bounded memory.
+// Code is encoded straight to a spool file, forward references are backpatched as soon as their label
+// gets defined, and only the label table, the pending references and the string index stay in memory.
+// The input is split on line boundaries, so string literals can't span several lines.
+// Returns 0 on success.
+int assemble_stream(FILE* input, const char* out_name);
+
+#endif // STREAM_H_INCLUDED
@@ -0,0 +1,63 @@
+#include "string_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void string_pool_init(string_pool_t* pool)
+{
+    pool->chunk = NULL;
+}
+
+char* string_pool_reserve(string_pool_t* pool, size_t size)
+{
+    string_pool_chunk_t* chunk = pool->chunk;
+    if (chunk && chunk->size - chunk->used >= size)
+        return chunk->data + chunk->used;
+
+    size_t chunk_size = size > STRING_POOL_CHUNK_SIZE ? size : STRING_POOL_CHUNK_SIZE;
+    chunk = malloc(sizeof(string_pool_chunk_t) + chunk_size);
+    chunk->prev = pool->chunk;
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    pool->chunk = chunk;
+
+    return chunk->data;
+}
+
+char* string_pool_grow(string_pool_t* pool, char* ptr, size_t used, size_t size)
+{
+    char* new_ptr = string_pool_reserve(pool, size);
+    if (new_ptr != ptr)
+        memcpy(new_ptr, ptr, used);
+
+    return new_ptr;
+}
+
+void string_pool_commit(string_pool_t* pool, size_t size)
+{
+    pool->chunk->used += size;
+}
+
+void string_pool_clear(string_pool_t* pool)
+{
+    if (!pool->chunk)
+        return;
+
+    string_pool_chunk_t* chunk = pool->chunk->prev;
+    while (chunk)
+    {
+        string_pool_chunk_t* prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+
+    pool->chunk->prev = NULL;
+    pool->chunk->used = 0;
+}
+
+void string_pool_free(string_pool_t* pool)
+{
+    string_pool_clear(pool);
+    free(pool->chunk);
+    pool->chunk = NULL;
+}
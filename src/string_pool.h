@@ -0,0 +1,33 @@
+#ifndef STRING_POOL_H_INCLUDED
+#define STRING_POOL_H_INCLUDED
+
+#include <stddef.h>
+
+// Bump allocator for the decoded string constants of a unit.
+// Memory comes in chunks that never move, so the pointers handed out stay valid until the pool is cleared.
+
+#define STRING_POOL_CHUNK_SIZE 65536
+
+typedef struct string_pool_chunk_t
+{
+    struct string_pool_chunk_t* prev;
+    size_t size, used;
+    char data[];
+} string_pool_chunk_t;
+
+typedef struct string_pool_t
+{
+    string_pool_chunk_t* chunk; // current one, NULL until the first allocation
+} string_pool_t;
+
+void string_pool_init(string_pool_t* pool);
+// returns at least 'size' writable bytes at the top of the pool, they stay free until committed
+char* string_pool_reserve(string_pool_t* pool, size_t size);
+// like string_pool_reserve, keeping the first 'used' bytes of the current reservation 'ptr'
+char* string_pool_grow(string_pool_t* pool, char* ptr, size_t used, size_t size);
+void  string_pool_commit(string_pool_t* pool, size_t size);
+// frees everything but the current chunk, which is emptied
+void  string_pool_clear(string_pool_t* pool);
+void  string_pool_free(string_pool_t* pool);
+
+#endif // STRING_POOL_H_INCLUDED
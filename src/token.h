@@ -0,0 +1,14 @@
+#ifndef TOKEN_H_INCLUDED
+#define TOKEN_H_INCLUDED
+
+#include <stdint.h>
+
+// a lexed identifier or operand, hashed once by the lexer so that table lookups never rehash it
+typedef struct token_t
+{
+    const char* str; // NUL-terminated
+    int len;
+    uint64_t hash;   // mem_hash(str, len)
+} token_t;
+
+#endif // TOKEN_H_INCLUDED
@@ -0,0 +1,54 @@
+#ifndef URING_H_INCLUDED
+#define URING_H_INCLUDED
+
+// Minimal io_uring wrapper over the raw system calls, for builds without liburing.
+// Only available on Linux, uring_init fails (and callers fall back to plain system calls) when the kernel
+// doesn't support io_uring or forbids it.
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_URING 1
+#endif
+#endif
+
+#ifdef HAVE_URING
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+typedef struct uring_t
+{
+    int fd;
+    unsigned entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    void* cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    unsigned to_submit;
+} uring_t;
+
+// returns 0 on success
+int  uring_init(uring_t* ring, unsigned entries);
+void uring_exit(uring_t* ring);
+// returns 1 if the kernel supports all of the 'count' IORING_OP_* opcodes, kernels before 5.6 can set up
+// a ring but can't be probed, and lack the file opcodes anyway
+int  uring_supports(uring_t* ring, const uint8_t* ops, int count);
+// cleared entry, NULL when the submission queue is full
+struct io_uring_sqe* uring_get_sqe(uring_t* ring);
+// submits the queued entries and waits for at least 'wait' completions
+int  uring_submit(uring_t* ring, unsigned wait);
+// pops a completion, returns 0 when there is none
+int  uring_pop_cqe(uring_t* ring, struct io_uring_cqe* cqe);
+
+#endif // HAVE_URING
+
+#endif // URING_H_INCLUDED
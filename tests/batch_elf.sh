@@ -0,0 +1,34 @@
+#!/bin/sh
+# --batch --format elf must write the same valid object as a single assembly
+set -e
+assembler="$1"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/unit.dpa" <<'SRC'
+_global_init:
+pushi #5
+call f
+syscall #0
+syscall #3
+ret
+f:
+pushi #2
+mul
+ret
+SRC
+
+"$assembler" "$dir/unit.dpa" --format elf -o "$dir/single.o" > /dev/null
+mkdir "$dir/batch"
+echo "$dir/unit.dpa $dir/batch/single.o" > "$dir/list"
+for io in uring pread; do
+    rm -f "$dir/batch/single.o"
+    if [ "$io" = pread ]; then
+        "$assembler" --batch "$dir/list" --batch-io pread --format elf > /dev/null
+    else
+        "$assembler" --batch "$dir/list" --format elf > /dev/null
+    fi
+    readelf -h -S -s "$dir/batch/single.o" > /dev/null
+    readelf -s "$dir/batch/single.o" | grep -q single_label_f
+    cmp "$dir/single.o" "$dir/batch/single.o"
+done